@@ -0,0 +1,33 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bits are packed MSB first, so the first bit written ends up in the highest
+// bit of data[0]. This matches the codeword layout used by the QR standard.
+typedef struct BitStream {
+    uint8_t* data;
+    size_t capacity;    // capacity in bytes
+    size_t size;        // number of bits written
+    size_t cursor;      // read position in bits
+    bool ownsData;
+} BitStream;
+
+BitStream* createBitStream(size_t capacity);
+void initBitStream(BitStream* bs, uint8_t* buffer, size_t capacity);
+void freeBitStream(BitStream* bs);
+void resetBitStream(BitStream* bs);
+
+void appendBits(BitStream* bs, uint32_t value, unsigned int numBits);
+void appendBytes(BitStream* bs, const uint8_t* bytes, size_t numBytes);
+
+unsigned int readBit(BitStream* bs);
+uint32_t readBits(BitStream* bs, unsigned int numBits);
+
+#endif
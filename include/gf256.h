@@ -0,0 +1,65 @@
+#ifndef GF256_H
+#define GF256_H
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// GF(256) arithmetic over the QR code polynomial x^8 + x^4 + x^3 + x^2 + 1.
+// The vector kernels below are picked at runtime from the best instruction set
+// the CPU supports, falling back to plain C on anything that isn't x86-64.
+
+// Remainder registers and feedback rows are always this wide, see gf256PolyRemainder()
+#define GF256_REGISTER_SIZE 32
+
+typedef enum GF256Kernel {
+    GF256_KERNEL_SCALAR,
+    GF256_KERNEL_SSSE3,
+    GF256_KERNEL_AVX2,
+    GF256_KERNEL_GFNI,
+    GF256_KERNEL_COUNT,
+} GF256Kernel;
+
+// Everything the kernels need to multiply by one constant. Build it once with
+// initGF256Multiplier() and reuse it for every vector multiplied by that value.
+typedef struct GF256Multiplier {
+    uint8_t value;
+    uint8_t low[16];    // value * i for the low nibble i
+    uint8_t high[16];   // value * (i << 4) for the high nibble i
+    uint64_t affine;    // bit matrix of the multiplication, for GF2P8AFFINEQB
+} GF256Multiplier;
+
+extern const uint8_t gf256logLUT[256];
+extern const uint8_t gf256antilogLUT[256];
+
+uint8_t gf256Multiply(uint8_t a, uint8_t b);
+uint8_t gf256Inverse(uint8_t a);
+void initGF256Multiplier(GF256Multiplier* m, uint8_t value);
+// Shared, prebuilt multiplier for each of the 256 field elements
+const GF256Multiplier* getGF256Multiplier(uint8_t value);
+
+// dst[i] = src[i] * m
+void gf256MulScalar(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size);
+// dst[i] ^= src[i] * m
+void gf256MulAdd(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size);
+// accumulator[i] ^= sum of coefficients[j] * rows[j][i], over a full register
+void gf256MulAddRows(uint8_t* accumulator, const uint8_t* coefficients, size_t count,
+        const uint8_t (*rows)[GF256_REGISTER_SIZE]);
+// Runs one synthetic division step per message byte on a GF256_REGISTER_SIZE byte
+// remainder register. feedbackRows[f] holds f times the divisor's non-leading
+// coefficients, zero padded to GF256_REGISTER_SIZE bytes.
+void gf256PolyRemainder(uint8_t* remainder, const uint8_t* msg, size_t msgSize,
+        const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]);
+// gf256PolyRemainder() for several equal length messages at once
+void gf256PolyRemainders(uint8_t (*remainders)[GF256_REGISTER_SIZE], const uint8_t* const* msgs,
+        size_t numMsgs, size_t msgSize, const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]);
+
+bool gf256KernelSupported(GF256Kernel kernel);
+bool gf256UseKernel(GF256Kernel kernel);
+GF256Kernel gf256ActiveKernel(void);
+const char* gf256KernelName(GF256Kernel kernel);
+
+#endif
@@ -2,20 +2,29 @@
 #define POLYNOMIAL_H
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// GF(256) polynomial, highest degree coefficient first
 typedef struct Polynomial {
-    unsigned int* data;
+    uint8_t* data;
     size_t size;
 } Polynomial;
 
+// Non-owning window onto the coefficients of another buffer
+typedef struct PolynomialView {
+    const uint8_t* data;
+    size_t size;
+} PolynomialView;
+
 Polynomial* createPolynomial(size_t size);
 void freePolynomial(Polynomial* p);
 
 Polynomial* copyPolynomial(Polynomial* p);
 Polynomial* slicePolynomial(Polynomial* p, unsigned int start, unsigned int end);
+PolynomialView viewPolynomial(const Polynomial* p, unsigned int start, unsigned int end);
 void printPolynomial(Polynomial* p);
 
 #endif
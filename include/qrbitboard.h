@@ -0,0 +1,121 @@
+#ifndef QRBITBOARD_H
+#define QRBITBOARD_H
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qrencode.h"
+
+// Scoring planes get a row per bit of a padded row, so they transpose in place
+#define MAX_BITBOARD_ROWS (MAX_BITBOARD_ROW_WORDS * 64)
+// One thread per mask is as far as the mask search can spread
+#define MAX_MASK_THREADS 8
+// Rows findFastMaskScoringPlanes() scores conditions 1 to 3 on
+#define FAST_MASK_ROWS 25
+
+static inline const uint64_t* getBitboardRow(const uint64_t* plane, const QRBitboard* bb,
+        unsigned int row) {
+    return plane + row * bb->rowWords;
+}
+
+static inline bool getBitboardModule(const uint64_t* plane, const QRBitboard* bb,
+        unsigned int row, unsigned int col) {
+    return (plane[row * bb->rowWords + col / 64] >> (col % 64)) & 1;
+}
+
+static inline void setBitboardModule(uint64_t* plane, const QRBitboard* bb,
+        unsigned int row, unsigned int col, bool value) {
+    uint64_t bit = (uint64_t)1 << (col % 64);
+    if (value)
+        plane[row * bb->rowWords + col / 64] |= bit;
+    else
+        plane[row * bb->rowWords + col / 64] &= ~bit;
+}
+
+// The module values of a matrix split into bitplanes for penalty scoring. low
+// holds bit 0 of every value and high holds bit 1, which is only set on the
+// reserved format (2) and version (3) modules. Those count as colours of their
+// own, so the scores match scoreQR() on the byte matrix exactly. Everything
+// past the width is zero.
+typedef struct QRScoringPlanes {
+    unsigned int width;
+    uint64_t low[MAX_BITBOARD_ROWS][MAX_BITBOARD_ROW_WORDS];
+    uint64_t high[MAX_BITBOARD_ROWS][MAX_BITBOARD_ROW_WORDS];
+} QRScoringPlanes;
+
+// The eight mask patterns of one version, already limited to its data
+// modules, packed row by row like QRScoringPlanes. Each QRTemplate has one.
+struct QRMaskPlanes {
+    unsigned int width;
+    uint64_t rows[][MAX_BITBOARD_ROW_WORDS];    // 8 * width rows, mask by mask
+};
+
+static inline const uint64_t* getMaskPlaneRow(const QRMaskPlanes* masks, unsigned int maskType,
+        unsigned int row) {
+    return masks->rows[maskType * masks->width + row];
+}
+
+// Points bb at modules, which must hold width * rowWords words, and clears them
+void initQRBitboard(QRBitboard* bb, unsigned int version, uint64_t* modules);
+QRBitboard* createQRBitboard(unsigned int version);
+QRBitboard* copyQRBitboard(const QRBitboard* bb);
+void freeQRBitboard(QRBitboard* bb);
+bool equalQRBitboards(const QRBitboard* a, const QRBitboard* b);
+
+// Builds the function or reserved plane of a QRTemplate from its blank symbol
+uint64_t* createFunctionPlane(const QR* blank);
+uint64_t* createReservedPlane(const QR* blank);
+
+// Packs bit 0 of every module, so reserved format modules (2) come out light
+// and reserved version modules (3) dark, like the low scoring plane. The
+// function plane is the version's, qr has to have the same function patterns.
+void packQRBitboardInto(QRBitboard* bb, const QR* qr);
+QRBitboard* packQRBitboard(const QR* qr);
+QR* unpackQRBitboard(const QRBitboard* bb);
+
+// Flips the data modules of bb by one of the template's masks
+void applyMaskBitboard(QRBitboard* bb, const QRMaskPlanes* masks, unsigned int maskType);
+// Same modules as addFormatInformation() and addVersionInformation()
+void addFormatInformationBitboard(QRBitboard* bb, ErrorCorrectionLevel ecLevel, unsigned int maskType);
+void addVersionInformationBitboard(QRBitboard* bb);
+
+QRMaskPlanes* createQRMaskPlanes(const QR* blank);
+// dest gets src with the data modules flipped by the mask, dest may be src
+void applyMaskPlanes(QR* dest, const QR* src, const QRMaskPlanes* masks, unsigned int maskType);
+
+void packQRScoringPlanes(QRScoringPlanes* planes, const QR* qr);
+// Same planes as packQRScoringPlanes() on the unpacked symbol. reserved is the
+// template's reserved plane while the format and version modules are still
+// reserved, NULL once they hold their information.
+void packQRScoringPlanesBitboard(QRScoringPlanes* planes, const QRBitboard* bb, const uint64_t* reserved);
+// Same as applyMaskPlanes(), for scoring planes
+void applyMaskScoringPlanes(QRScoringPlanes* dest, const QRScoringPlanes* src, const QRMaskPlanes* masks,
+        unsigned int maskType);
+// Same scores as scoreCondition1() to scoreCondition4() and scoreQR()
+unsigned int scoreCondition1Bitboard(const QRScoringPlanes* planes);
+unsigned int scoreCondition2Bitboard(const QRScoringPlanes* planes);
+unsigned int scoreCondition3Bitboard(const QRScoringPlanes* planes);
+unsigned int scoreCondition4Bitboard(const QRScoringPlanes* planes);
+unsigned int scoreQRBitboard(const QRScoringPlanes* planes);
+// Returns the mask scoreQR() would pick, lowest mask number on a tie. With
+// numThreads > 1 the masks are scored on that many threads, the calling one
+// included. Otherwise they are applied to planes in place and taken off
+// again. stats may be NULL.
+unsigned int findBestMaskScoringPlanes(QRScoringPlanes* planes, const QRMaskPlanes* masks,
+        unsigned int numThreads, QRMaskSearchStats* stats);
+// Cheaper guess at the same mask, which only looks at FAST_MASK_ROWS rows
+// whatever the version. Symbols up to that width get the exact answer.
+unsigned int findFastMaskScoringPlanes(QRScoringPlanes* planes, const QRMaskPlanes* masks,
+        QRMaskSearchStats* stats);
+
+void printQRBitboard(const QRBitboard* bb, bool invertColors);
+
+#endif
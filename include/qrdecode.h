@@ -0,0 +1,45 @@
+#ifndef QRDECODE_H
+#define QRDECODE_H
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitstream.h"
+#include "qrencode.h"
+#include "reedsolomon.h"
+
+// Format and version information are accepted up to this many bits away from
+// a valid codeword, the most their BCH codes can correct
+#define MAX_FORMAT_INFO_ERRORS 3
+#define MAX_VERSION_INFO_ERRORS 3
+
+typedef enum {
+    QR_DECODE_OK,
+    QR_DECODE_BAD_SIZE,         // the width isn't 17 + 4 * version
+    QR_DECODE_BAD_FORMAT,       // neither format info copy is readable
+    QR_DECODE_BAD_VERSION,      // version info doesn't match the width
+    QR_DECODE_UNCORRECTABLE,    // a block has too many errors
+    QR_DECODE_BAD_SEGMENT,      // the data stream is malformed or uses an unsupported mode
+    QR_DECODE_OVERFLOW,         // the payload doesn't fit the caller's buffer
+} QRDecodeStatus;
+
+typedef struct QRDecodeResult {
+    QRDecodeStatus status;
+    unsigned int version;
+    ErrorCorrectionLevel ecLevel;
+    unsigned int maskType;
+    size_t length;                      // payload bytes written
+    unsigned int correctedCodewords;    // codewords fixed by Reed-Solomon
+} QRDecodeResult;
+
+// Reads a symbol built by createQRCode() back into its payload. Only the
+// module values are used, never the function flags, so the matrix is read the
+// way a scanner would see it.
+QRDecodeResult decodeQR(const QR* qr, uint8_t* payload, size_t payloadCapacity);
+const char* getQRDecodeStatusString(QRDecodeStatus status);
+
+#endif
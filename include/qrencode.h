@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -11,15 +12,27 @@
 #include <string.h>
 #include <sys/param.h>
 
-#include "linkedlist.h"
+#include "bitstream.h"
 #include "polynomial.h"
 #include "qrluts.h"
 #include "reedsolomon.h"
 
+// Each module is stored in one byte: the low 7 bits hold the module value and
+// the high bit flags modules that belong to a function pattern
+#define MODULE_FUNCTION 0x80
+#define MODULE_VALUE_MASK 0x7F
 // value to mark a module as unset
-#define UNSET_MODULE 0xFF
+#define UNSET_MODULE 0x7F
 // 7089 is the maximum number of characters storable in a QR code - Version 40-L, Numeric
 #define MAX_QR_CHARS 7089
+// 2956 is the maximum number of data codewords in a QR code - Version 40-L
+#define MAX_DATA_CODEWORDS 2956
+// 2430 is the maximum number of error correction codewords - Version 40-H
+#define MAX_EC_CODEWORDS 2430
+// 81 is the maximum number of blocks the data is split into - Version 40-H
+#define MAX_DATA_BLOCKS 81
+// 177 is the width of the largest QR code - Version 40
+#define MAX_QR_WIDTH 177
 
 typedef enum {
     MODE_NUMERIC,
@@ -36,37 +49,181 @@ typedef enum {
     EC_H,
 } ErrorCorrectionLevel;
 
+// Everything about how a payload will be encoded, worked out in one pass over it
+typedef struct EncodingPlan {
+    EncodingMode mode;
+    ErrorCorrectionLevel ecLevel;
+    size_t length;          // number of characters in the payload
+    unsigned int bitCount;  // bits in the encoded segment, including the mode and count headers
+    unsigned int version;
+    unsigned int capacity;  // max characters for the mode at this version and EC level
+} EncodingPlan;
+
+// The fast engine is the optimised pipeline behind createQRCode(). The reference
+// engine is the original step by step pipeline, kept as a baseline to check the
+// fast engine against. Both share the data encoding, the block split, the
+// function pattern builders and the format/version info. The interleaving, the
+// Reed-Solomon division, the zigzag placement and the mask scoring are done
+// separately, so only those are checked independently. The RS generator tables
+// (getRSGenerator()) are built once and shared by every GF(256) kernel, so
+// switching kernels doesn't check how they were built either.
+typedef enum {
+    QR_ENGINE_FAST,
+    QR_ENGINE_REFERENCE,
+} QREngine;
+
+// Mask threads only pay off on large symbols, smaller ones are always scored
+// on the calling thread
+#define DEFAULT_PARALLEL_MASK_MIN_VERSION 25
+
+// How the mask is chosen. Auto picks the mask with the lowest penalty score,
+// fast guesses it from part of the symbol and fixed skips scoring altogether.
+// Only the fast engine implements the fast policy, so it can't be combined with
+// the reference engine or crossCheck.
+typedef enum {
+    QR_MASK_AUTO,
+    QR_MASK_FAST,
+    QR_MASK_FIXED,
+} QRMaskPolicy;
+
+typedef struct QROptions {
+    QREngine engine;
+    bool crossCheck;    // also build the symbol with the other engine, abort() if they differ
+    QRMaskPolicy maskPolicy;
+    unsigned int fixedMask;                 // mask QR_MASK_FIXED uses, 0 to 7
+    unsigned int maskThreads;               // threads the fast engine scores masks on, 1 for none
+    unsigned int parallelMaskMinVersion;    // smallest version that uses the mask threads
+} QROptions;
+
 typedef struct QR {
     unsigned int version;
     unsigned int width;
-    unsigned int** data;
+    uint8_t* data;      // width * width modules, row by row
 } QR;
 
+// Number of 64-bit words needed for one row of the largest (177 module) QR code
+#define MAX_BITBOARD_ROW_WORDS 3
+
+// Bit-packed QR matrix: one bit per module, each row padded to whole 64-bit
+// words. Module (row, col) is bit (col % 64) of word (col / 64) in its row and
+// the padding bits are always clear. The function bitplane marks finder,
+// timing, alignment and reserved format and version modules, so no sentinel
+// values are needed for unset modules. It only depends on the version, so it
+// belongs to the version's QRTemplate and every bitboard points at that one.
+typedef struct QRBitboard {
+    unsigned int version;
+    unsigned int width;
+    unsigned int rowWords;      // 64-bit words per row
+    uint64_t* modules;          // dark modules, width * rowWords words
+    const uint64_t* function;   // function pattern modules, laid out like modules
+} QRBitboard;
+
+// Packed mask patterns, see qrbitboard.h
+typedef struct QRMaskPlanes QRMaskPlanes;
+
+// Everything about a symbol that only depends on its version
+typedef struct QRTemplate {
+    QR* blank;                      // function patterns with format/version info reserved
+    QRMaskPlanes* maskPlanes;       // the eight masks, data modules only
+    uint64_t* functionPlane;        // QRBitboard function plane of the version
+    uint64_t* reservedPlane;        // reserved format/version modules, same layout
+    uint16_t* dataModuleOffsets;    // module offsets (row * width + col) in placement order
+    size_t numDataModules;
+    // For each error correction level, the index in the interleaved final message
+    // of every codeword in block order (data blocks first, then EC blocks)
+    uint16_t* codewordPositions[4];
+} QRTemplate;
+
 typedef struct DataBlocks {
-    Polynomial** group1;
+    PolynomialView* group1;
     unsigned int numGroup1Blocks;
     unsigned int codewordsPerGroup1Block;
-    Polynomial** group2;
+    PolynomialView* group2;
     unsigned int numGroup2Blocks;
     unsigned int codewordsPerGroup2Block;
+    uint8_t* codewords;     // buffer the views point into when owned by the blocks, otherwise NULL
 } DataBlocks;
 
+static inline uint8_t getModule(const QR* qr, unsigned int row, unsigned int col) {
+    return qr->data[row * qr->width + col] & MODULE_VALUE_MASK;
+}
+
+static inline bool isFunctionModule(const QR* qr, unsigned int row, unsigned int col) {
+    return (qr->data[row * qr->width + col] & MODULE_FUNCTION) != 0;
+}
+
+static inline void setModule(QR* qr, unsigned int row, unsigned int col, uint8_t value) {
+    qr->data[row * qr->width + col] = value;
+}
+
+static inline void setFunctionModule(QR* qr, unsigned int row, unsigned int col, uint8_t value) {
+    qr->data[row * qr->width + col] = value | MODULE_FUNCTION;
+}
+
+// Work done by the fast engine's mask search, summed over every symbol. A
+// matrix pass is one sweep over the rows of a matrix: scoring a mask in full
+// takes two (condition 4, then conditions 1 to 3 together), so trying every
+// mask takes 16. Masks given up part way through count the fraction of rows
+// they got to.
+typedef struct QRMaskSearchStats {
+    unsigned long symbols;
+    unsigned long masksPruned;  // masks dropped before their full score
+    double matrixPasses;
+} QRMaskSearchStats;
+
+// Scratch space for createQRCodeInto(), sized for the largest QR code so that a
+// symbol of any version can be built without allocating. A workspace must only
+// be used by one thread at a time. The one-shot functions (createQRCode(),
+// createQRCodeWithOptions() and friends) allocate and free a whole workspace,
+// about 70KB, on every call: reusing one with createQRCodeInto() is the only
+// way to build symbols without allocating.
+typedef struct QRWorkspace {
+    QR qr;              // the symbol returned by createQRCodeInto()
+    QR placed;          // qr before masking, kept for updateQRCodeInto()
+    QRBitboard bitboard;    // the symbol returned by createQRBitboardInto()
+    DataBlocks dataBlocks;
+    EncodingPlan plan;  // plan of the symbol in qr
+    bool hasSymbol;     // whether qr, placed and the codewords match plan
+    QRMaskSearchStats maskSearchStats;
+    QRMaskPolicy maskPolicy;                // see QROptions
+    unsigned int fixedMask;
+    unsigned int maskThreads;
+    unsigned int parallelMaskMinVersion;
+
+    uint8_t modules[MAX_QR_WIDTH * MAX_QR_WIDTH];
+    uint8_t placedModules[MAX_QR_WIDTH * MAX_QR_WIDTH];
+    uint64_t bitboardModules[MAX_QR_WIDTH * MAX_BITBOARD_ROW_WORDS];
+    uint8_t dataCodewords[MAX_DATA_CODEWORDS];
+    uint8_t newDataCodewords[MAX_DATA_CODEWORDS];
+    uint8_t ecCodewords[MAX_EC_CODEWORDS];      // interleaved
+    PolynomialView dataBlockViews[MAX_DATA_BLOCKS];
+} QRWorkspace;
+
 // Data encoding functions
+// The char* versions are wrappers for NUL-terminated strings. The rest take an
+// explicit length (directly or through the plan), so the data may contain 0x00.
+EncodingPlan planEncodingBytes(const uint8_t* data, size_t dataLength, ErrorCorrectionLevel ecLevel);
+EncodingPlan planEncoding(char* data, ErrorCorrectionLevel ecLevel);
+unsigned int calculateQRVersionBytes(const uint8_t* data, size_t dataLength,
+        ErrorCorrectionLevel ecLevel);
 unsigned int calculateQRVersion(char* data, ErrorCorrectionLevel ecLevel);
 unsigned int getMaxQRCharacters(char* data, ErrorCorrectionLevel ecLevel);
-Polynomial* encodeData(char* data, unsigned int qrVersion, ErrorCorrectionLevel ecLevel);
+unsigned int getCharacterCountBits(EncodingMode encodingMode, unsigned int qrVersion);
+Polynomial* encodeData(const uint8_t* data, const EncodingPlan* plan);
+void encodeDataInto(const uint8_t* data, const EncodingPlan* plan, uint8_t* codewords);
 DataBlocks* fragmentEncodedData(Polynomial* encodedData, unsigned int qrVersion,
         ErrorCorrectionLevel ecLevel);
 DataBlocks* rsEncodeDataBlocks(DataBlocks* dataBlocks, unsigned int qrVersion,
         ErrorCorrectionLevel ecLevel);
-linkedlist* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsCodewordBlocks,
+BitStream* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsCodewordBlocks,
         unsigned int qrVersion, ErrorCorrectionLevel ecLevel);
 void freeDataBlocks(DataBlocks* dataBlocks);
 
 // Module placement functions
 QR* initQR(unsigned int version);
-QR* copyQR(QR* qr);
+QR* copyQR(const QR* qr);
 void freeQR(QR* qr);
+const QRTemplate* getQRTemplate(unsigned int version);
 
 void addFinderPatterns(QR* qr);
 void addSeparators(QR* qr);
@@ -75,16 +232,55 @@ void addTimingPatterns(QR* qr);
 void addDarkModule(QR* qr);
 void reserveFormatInfo(QR* qr);
 void reserveVersionInfo(QR* qr);
-QR* createMask(QR* qr, unsigned int maskType);
-void placeDataBits(QR* qr, linkedlist* data);
+bool maskCondition(unsigned int maskType, unsigned int row, unsigned int col);
+QR* createMask(const QR* qr, unsigned int maskType);
+void placeDataBits(QR* qr, BitStream* data);
+void placeDataBlocks(QR* qr, DataBlocks* dataBlocks, DataBlocks* rsDataBlocks,
+        ErrorCorrectionLevel ecLevel);
 QR* applyMask(QR* qr, QR* mask);
 void addFormatInformation(QR* qr, ErrorCorrectionLevel ecLevel, unsigned int maskType);
 void addVersionInformation(QR* qr);
 
+unsigned int scoreCondition1(QR* qr);
+unsigned int scoreCondition2(QR* qr);
+unsigned int scoreCondition3(QR* qr);
+unsigned int scoreCondition4(QR* qr);
+// Condition 4 penalty for the given number of dark modules
+unsigned int scoreDarkModuleRatio(unsigned int numDarkModules, unsigned int totalModules);
 unsigned int scoreQR(QR* qr);
-unsigned int calculateBestMask(QR* qr, QR* blankQR);
+unsigned int calculateBestMask(QR* qr, const QR* blankQR);
 
-QR* createQRCode(char* data, ErrorCorrectionLevel ecLevel);
+QRWorkspace* createQRWorkspace(void);
+void freeQRWorkspace(QRWorkspace* ws);
+QR* createQRCodeInto(QRWorkspace* ws, const uint8_t* data, const EncodingPlan* plan);
+// Re-encodes the symbol last built in ws for data that only differs from the
+// previous data in [changedStart, changedEnd). Only the affected codewords and
+// EC codewords are recomputed. The caller is responsible for the range covering
+// every change. It is still checked: if any data codeword outside it changed, or
+// the plan differs from the one the symbol was built with in any field, this
+// falls back to createQRCodeInto(). Either way the result is identical to a
+// full encode.
+QR* updateQRCodeInto(QRWorkspace* ws, const uint8_t* data, const EncodingPlan* plan,
+        size_t changedStart, size_t changedEnd);
+// Same symbol as createQRCodeInto(), masked and finished straight in bitboard
+// form without writing the byte matrix. ws->qr is left stale, so the next
+// updateQRCodeInto() on ws starts from scratch.
+const QRBitboard* createQRBitboardInto(QRWorkspace* ws, const uint8_t* data, const EncodingPlan* plan);
+// Builds the symbol in a temporary workspace and returns a copy of it
+QR* createQRCode(const uint8_t* data, const EncodingPlan* plan);
+QR* createQRCodeReference(const uint8_t* data, const EncodingPlan* plan);
+void initQROptions(QROptions* options);
+const char* getQREngineName(QREngine engine);
+// Parses "auto", "fast" or a mask number from 0 to 7 into options
+bool parseQRMaskPolicy(const char* text, QROptions* options);
+// Writes the policy in the form parseQRMaskPolicy() takes
+void formatQRMaskPolicy(char* buffer, size_t size, const QROptions* options);
+// Returns true and the first differing module if the two symbols aren't identical
+bool findModuleMismatch(const QR* a, const QR* b, unsigned int* row, unsigned int* col);
+// options may be NULL for the defaults, the fast engine without cross-checking
+QR* createQRCodeWithOptions(const uint8_t* data, const EncodingPlan* plan, const QROptions* options);
+QR* createQRCodeFromBytes(const uint8_t* data, size_t dataLength, ErrorCorrectionLevel ecLevel);
+QR* createQRCodeFromString(char* data, ErrorCorrectionLevel ecLevel);
 void printQR(QR* qr, bool invertColors);
 
 #endif
@@ -177,6 +177,15 @@ static const unsigned int kanjiCharCapacityLUT[41][4] = {
 	{1817, 1435, 1024, 784},
 };
 
+// Character count indicator lengths for the numeric, alphanumeric, byte and
+// kanji modes, for versions 1-9, 10-26 and 27-40
+static const unsigned int characterCountBitsLUT[4][3] = {
+    {10, 12, 14},
+    { 9, 11, 13},
+    { 8, 16, 16},
+    { 8, 10, 12},
+};
+
 static const unsigned int alignmentLUT[41][7] = {
     {0,  0,  0,  0,   0,   0,   0},
     {0,  0,  0,  0,   0,   0,   0},
@@ -2,26 +2,73 @@
 #define REEDSOLOMON_H
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/param.h>
 
+#include "gf256.h"
 #include "polynomial.h"
 
+// A Reed-Solomon codeword over GF(256) can't be longer than 255 bytes
+#define RS_MAX_CODEWORDS 255
+// A generator for 30 EC codewords has 31 terms
+#define RS_MAX_GENERATOR_SIZE 31
+// rsEncodeInterleaved() runs at most this many blocks side by side
+#define RS_MAX_LANES 128
+
+// QR codes use between 7 and 30 EC codewords per block
+#define RS_MIN_EC_CODEWORDS 7
+#define RS_MAX_EC_CODEWORDS 30
+
+// Generator polynomial for a fixed number of EC codewords, built once and shared.
+// logs[i] is the discrete log of coefficients[i], all generator coefficients are
+// nonzero so the log form is always defined.
+// feedbackRows[f][k] is f * coefficients[k+1], the value XORed into register
+// cell k when f is fed back through the encoder's shift register.
+// unitParity[d] holds the EC codewords of a message that is all zeros except
+// for a 1 that is d codewords from its end. The code is linear, so changing a
+// codeword by delta changes the EC codewords by delta * unitParity[d].
+typedef struct RSGenerator {
+    Polynomial polynomial;  // view onto coefficients, size numECCodewords + 1
+    uint8_t coefficients[RS_MAX_GENERATOR_SIZE];
+    uint8_t logs[RS_MAX_GENERATOR_SIZE];
+    uint8_t feedbackRows[256][GF256_REGISTER_SIZE];
+    uint8_t unitParity[RS_MAX_CODEWORDS][GF256_REGISTER_SIZE];
+} RSGenerator;
+
+// Returned by rsDecodeBlock() when a block has more errors than it can correct
+#define RS_DECODE_FAILURE -1
+
 typedef struct PolyDivisionResult {
     Polynomial* quotient;
     Polynomial* remainder;
 } PolyDivisionResult;
 
-unsigned int gf256Multiply(unsigned int a, unsigned int b);
-
 void freePolyDivisionResult(PolyDivisionResult* result);
 
-Polynomial* gf256PolyScalarMultiply(Polynomial* p, unsigned int s);
+Polynomial* gf256PolyScalarMultiply(Polynomial* p, uint8_t s);
 Polynomial* gf256PolyAdd(Polynomial* a, Polynomial* b);
 Polynomial* gf256PolyMultiply(Polynomial* a, Polynomial* b);
 PolyDivisionResult* gf256PolyDivide(Polynomial* dividend, Polynomial* divisor);
 
 Polynomial* createGeneratorPolynomial(unsigned int numECCodewords);
+void computeGeneratorPolynomial(uint8_t* coefficients, unsigned int numECCodewords);
 Polynomial* rsEncodePolynomial(Polynomial* msg, Polynomial* generator);
+const RSGenerator* getRSGenerator(unsigned int numECCodewords);
+void rsEncodeBlock(PolynomialView msg, const RSGenerator* generator, uint8_t* ecCodewords);
+void rsEncodeInterleaved(const PolynomialView* blocks, size_t numBlocks, const RSGenerator* generator,
+        uint8_t* ecCodewords);
+void rsUpdateParity(const RSGenerator* generator, uint8_t* ecCodewords, size_t stride,
+        size_t distanceFromEnd, uint8_t delta);
+
+// Decoding works on a whole block: the data codewords followed by the EC codewords
+bool rsCalculateSyndromes(const uint8_t* codewords, size_t size, unsigned int numECCodewords,
+        uint8_t* syndromes);
+bool rsCheckBlock(const uint8_t* codewords, size_t size, unsigned int numECCodewords);
+int rsDecodeBlock(uint8_t* codewords, size_t size, unsigned int numECCodewords,
+        const unsigned int* erasures, size_t numErasures);
 
 #endif
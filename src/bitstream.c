@@ -0,0 +1,92 @@
+#include "bitstream.h"
+
+BitStream* createBitStream(size_t capacity) {
+    assert(capacity > 0);
+    BitStream* bs = (BitStream*)malloc(sizeof(BitStream));
+    uint8_t* buffer = (uint8_t*)malloc(sizeof(uint8_t) * capacity);
+    if (bs == NULL || buffer == NULL) {
+        perror("createBitStream() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    initBitStream(bs, buffer, capacity);
+    bs->ownsData = true;
+    return bs;
+}
+
+void initBitStream(BitStream* bs, uint8_t* buffer, size_t capacity) {
+    bs->data = buffer;
+    bs->capacity = capacity;
+    bs->ownsData = false;
+    resetBitStream(bs);
+}
+
+void freeBitStream(BitStream* bs) {
+    if (bs->ownsData && bs->data != NULL) {
+        free(bs->data);
+        bs->data = NULL;
+    }
+    free(bs);
+}
+
+void resetBitStream(BitStream* bs) {
+    // appendBits() ORs bits into place, so the buffer has to start out cleared
+    memset(bs->data, 0, bs->capacity);
+    bs->size = 0;
+    bs->cursor = 0;
+}
+
+void appendBits(BitStream* bs, uint32_t value, unsigned int numBits) {
+    assert(numBits <= 32);
+    assert(bs->size + numBits <= bs->capacity * 8);
+
+    // Fill the partially written byte first, then whole bytes at a time
+    while (numBits > 0) {
+        unsigned int freeBits = 8 - (bs->size & 7);
+        unsigned int take = numBits < freeBits ? numBits : freeBits;
+        uint8_t chunk = (value >> (numBits - take)) & ((1u << take) - 1);
+
+        bs->data[bs->size >> 3] |= chunk << (freeBits - take);
+        bs->size += take;
+        numBits -= take;
+    }
+}
+
+void appendBytes(BitStream* bs, const uint8_t* bytes, size_t numBytes) {
+    assert(bs->size + numBytes * 8 <= bs->capacity * 8);
+
+    if ((bs->size & 7) == 0) {
+        memcpy(bs->data + (bs->size >> 3), bytes, numBytes);
+        bs->size += numBytes * 8;
+        return;
+    }
+
+    for (size_t i = 0; i < numBytes; i++)
+        appendBits(bs, bytes[i], 8);
+}
+
+unsigned int readBit(BitStream* bs) {
+    assert(bs->cursor < bs->size);
+    unsigned int bit = (bs->data[bs->cursor >> 3] >> (7 - (bs->cursor & 7))) & 1;
+    bs->cursor++;
+    return bit;
+}
+
+uint32_t readBits(BitStream* bs, unsigned int numBits) {
+    assert(numBits <= 32);
+    assert(bs->cursor + numBits <= bs->size);
+
+    uint32_t value = 0;
+    while (numBits > 0) {
+        unsigned int availBits = 8 - (bs->cursor & 7);
+        unsigned int take = numBits < availBits ? numBits : availBits;
+        uint8_t byte = bs->data[bs->cursor >> 3];
+        uint8_t chunk = (byte >> (availBits - take)) & ((1u << take) - 1);
+
+        value = (value << take) | chunk;
+        bs->cursor += take;
+        numBits -= take;
+    }
+
+    return value;
+}
@@ -0,0 +1,519 @@
+#include "gf256.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+const uint8_t gf256logLUT[256] = {
+    0, 0, 1, 25, 2, 50, 26, 198,
+    3, 223, 51, 238, 27, 104, 199, 75,
+    4, 100, 224, 14, 52, 141, 239, 129,
+    28, 193, 105, 248, 200, 8, 76, 113,
+    5, 138, 101, 47, 225, 36, 15, 33,
+    53, 147, 142, 218, 240, 18, 130, 69,
+    29, 181, 194, 125, 106, 39, 249, 185,
+    201, 154, 9, 120, 77, 228, 114, 166,
+    6, 191, 139, 98, 102, 221, 48, 253,
+    226, 152, 37, 179, 16, 145, 34, 136,
+    54, 208, 148, 206, 143, 150, 219, 189,
+    241, 210, 19, 92, 131, 56, 70, 64,
+    30, 66, 182, 163, 195, 72, 126, 110,
+    107, 58, 40, 84, 250, 133, 186, 61,
+    202, 94, 155, 159, 10, 21, 121, 43,
+    78, 212, 229, 172, 115, 243, 167, 87,
+    7, 112, 192, 247, 140, 128, 99, 13,
+    103, 74, 222, 237, 49, 197, 254, 24,
+    227, 165, 153, 119, 38, 184, 180, 124,
+    17, 68, 146, 217, 35, 32, 137, 46,
+    55, 63, 209, 91, 149, 188, 207, 205,
+    144, 135, 151, 178, 220, 252, 190, 97,
+    242, 86, 211, 171, 20, 42, 93, 158,
+    132, 60, 57, 83, 71, 109, 65, 162,
+    31, 45, 67, 216, 183, 123, 164, 118,
+    196, 23, 73, 236, 127, 12, 111, 246,
+    108, 161, 59, 82, 41, 157, 85, 170,
+    251, 96, 134, 177, 187, 204, 62, 90,
+    203, 89, 95, 176, 156, 169, 160, 81,
+    11, 245, 22, 235, 122, 117, 44, 215,
+    79, 174, 213, 233, 230, 231, 173, 232,
+    116, 214, 244, 234, 168, 80, 88, 175
+};
+
+const uint8_t gf256antilogLUT[256] = {
+    1, 2, 4, 8, 16, 32, 64, 128,
+    29, 58, 116, 232, 205, 135, 19, 38,
+    76, 152, 45, 90, 180, 117, 234, 201,
+    143, 3, 6, 12, 24, 48, 96, 192,
+    157, 39, 78, 156, 37, 74, 148, 53,
+    106, 212, 181, 119, 238, 193, 159, 35,
+    70, 140, 5, 10, 20, 40, 80, 160,
+    93, 186, 105, 210, 185, 111, 222, 161,
+    95, 190, 97, 194, 153, 47, 94, 188,
+    101, 202, 137, 15, 30, 60, 120, 240,
+    253, 231, 211, 187, 107, 214, 177, 127,
+    254, 225, 223, 163, 91, 182, 113, 226,
+    217, 175, 67, 134, 17, 34, 68, 136,
+    13, 26, 52, 104, 208, 189, 103, 206,
+    129, 31, 62, 124, 248, 237, 199, 147,
+    59, 118, 236, 197, 151, 51, 102, 204,
+    133, 23, 46, 92, 184, 109, 218, 169,
+    79, 158, 33, 66, 132, 21, 42, 84,
+    168, 77, 154, 41, 82, 164, 85, 170,
+    73, 146, 57, 114, 228, 213, 183, 115,
+    230, 209, 191, 99, 198, 145, 63, 126,
+    252, 229, 215, 179, 123, 246, 241, 255,
+    227, 219, 171, 75, 150, 49, 98, 196,
+    149, 55, 110, 220, 165, 87, 174, 65,
+    130, 25, 50, 100, 200, 141, 7, 14,
+    28, 56, 112, 224, 221, 167, 83, 166,
+    81, 162, 89, 178, 121, 242, 249, 239,
+    195, 155, 43, 86, 172, 69, 138, 9,
+    18, 36, 72, 144, 61, 122, 244, 245,
+    247, 243, 251, 235, 203, 139, 11, 22,
+    44, 88, 176, 125, 250, 233, 207, 131,
+    27, 54, 108, 216, 173, 71, 142, 1
+};
+
+typedef struct GF256KernelOps {
+    const char* name;
+    void (*mulScalar)(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size);
+    void (*mulAdd)(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size);
+    void (*mulAddRows)(uint8_t* accumulator, const uint8_t* coefficients, size_t count,
+            const uint8_t (*rows)[GF256_REGISTER_SIZE]);
+    void (*polyRemainder)(uint8_t* remainder, const uint8_t* msg, size_t msgSize,
+            const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]);
+    void (*polyRemainders)(uint8_t (*remainders)[GF256_REGISTER_SIZE], const uint8_t* const* msgs,
+            size_t numMsgs, size_t msgSize, const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]);
+} GF256KernelOps;
+
+static GF256Kernel activeKernel = GF256_KERNEL_SCALAR;
+static pthread_once_t kernelSelectOnce = PTHREAD_ONCE_INIT;
+
+static GF256Multiplier multipliers[256];
+static pthread_once_t multipliersOnce = PTHREAD_ONCE_INIT;
+
+uint8_t gf256Multiply(uint8_t a, uint8_t b) {
+    // log(0) is undefined, the log table just holds a placeholder for it
+    if (a == 0 || b == 0)
+        return 0;
+
+    unsigned int logA = gf256logLUT[a];
+    unsigned int logB = gf256logLUT[b];
+
+    unsigned int sum = logA + logB;
+
+    if (sum >= 256)
+        sum %= 255;
+
+    return gf256antilogLUT[sum];
+}
+
+uint8_t gf256Inverse(uint8_t a) {
+    assert(a != 0);
+    return gf256antilogLUT[(255 - gf256logLUT[a]) % 255];
+}
+
+void initGF256Multiplier(GF256Multiplier* m, uint8_t value) {
+    // Multiplying by value is linear over GF(2), so everything follows from
+    // value * x^j for the 8 bit positions j
+    uint8_t basis[8];
+    basis[0] = value;
+    for (int j = 1; j < 8; j++)
+        basis[j] = (basis[j-1] << 1) ^ ((basis[j-1] & 0x80) ? 0x1D : 0);
+
+    m->value = value;
+    m->low[0] = 0;
+    m->high[0] = 0;
+    for (int i = 1; i < 16; i++) {
+        int bit = __builtin_ctz(i);
+        m->low[i] = m->low[i & (i - 1)] ^ basis[bit];
+        m->high[i] = m->high[i & (i - 1)] ^ basis[bit + 4];
+    }
+
+    // Row i of the matrix selects the input bits that contribute to output
+    // bit i. GF2P8AFFINEQB reads row i from byte 7 - i.
+    m->affine = 0;
+    for (int i = 0; i < 8; i++) {
+        uint8_t row = 0;
+        for (int j = 0; j < 8; j++)
+            row |= ((basis[j] >> i) & 1) << j;
+        m->affine |= (uint64_t)row << (8 * (7 - i));
+    }
+}
+
+static void buildMultipliers(void) {
+    for (int i = 0; i < 256; i++)
+        initGF256Multiplier(&multipliers[i], i);
+}
+
+const GF256Multiplier* getGF256Multiplier(uint8_t value) {
+    pthread_once(&multipliersOnce, buildMultipliers);
+    return &multipliers[value];
+}
+
+static inline uint8_t mulNibbles(const GF256Multiplier* m, uint8_t x) {
+    return m->low[x & 0x0F] ^ m->high[x >> 4];
+}
+
+// The loops below are always inlined, so the vector kernels get their tails
+// compiled for their own instruction set. Falling through to legacy SSE code
+// from an AVX function stalls on the dirty upper halves of the YMM registers.
+#define GF256_INLINE static inline __attribute__((always_inline))
+
+GF256_INLINE void mulScalarLoop(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        dst[i] = mulNibbles(m, src[i]);
+}
+
+GF256_INLINE void mulAddLoop(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        dst[i] ^= mulNibbles(m, src[i]);
+}
+
+static void mulScalarScalar(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    mulScalarLoop(dst, src, m, size);
+}
+
+static void mulAddScalar(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    mulAddLoop(dst, src, m, size);
+}
+
+static void mulAddRowsScalar(uint8_t* accumulator, const uint8_t* coefficients, size_t count,
+        const uint8_t (*rows)[GF256_REGISTER_SIZE]) {
+    for (size_t j = 0; j < count; j++) {
+        if (coefficients[j] != 0)
+            mulAddLoop(accumulator, rows[j], &multipliers[coefficients[j]], GF256_REGISTER_SIZE);
+    }
+}
+
+static void polyRemainderScalar(uint8_t* remainder, const uint8_t* msg, size_t msgSize,
+        const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]) {
+    for (size_t i = 0; i < msgSize; i++) {
+        const uint8_t* row = feedbackRows[msg[i] ^ remainder[0]];
+        for (int k = 0; k < GF256_REGISTER_SIZE - 1; k++)
+            remainder[k] = remainder[k+1] ^ row[k];
+        remainder[GF256_REGISTER_SIZE - 1] = row[GF256_REGISTER_SIZE - 1];
+    }
+}
+
+static void polyRemaindersScalar(uint8_t (*remainders)[GF256_REGISTER_SIZE], const uint8_t* const* msgs,
+        size_t numMsgs, size_t msgSize, const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]) {
+    for (size_t m = 0; m < numMsgs; m++)
+        polyRemainderScalar(remainders[m], msgs[m], msgSize, feedbackRows);
+}
+
+#if defined(__x86_64__)
+// SSSE3 and AVX2 multiply with two PSHUFB lookups, one per nibble
+
+__attribute__((target("ssse3")))
+GF256_INLINE __m128i mulSSSE3(__m128i x, __m128i lowTable, __m128i highTable) {
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    __m128i low = _mm_and_si128(x, nibbleMask);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(x, 4), nibbleMask);
+    return _mm_xor_si128(_mm_shuffle_epi8(lowTable, low), _mm_shuffle_epi8(highTable, high));
+}
+
+__attribute__((target("ssse3")))
+GF256_INLINE void mulScalarLoopSSSE3(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    __m128i lowTable = _mm_loadu_si128((const __m128i*)m->low);
+    __m128i highTable = _mm_loadu_si128((const __m128i*)m->high);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), mulSSSE3(x, lowTable, highTable));
+    }
+    mulScalarLoop(dst + i, src + i, m, size - i);
+}
+
+__attribute__((target("ssse3")))
+GF256_INLINE void mulAddLoopSSSE3(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    __m128i lowTable = _mm_loadu_si128((const __m128i*)m->low);
+    __m128i highTable = _mm_loadu_si128((const __m128i*)m->high);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, mulSSSE3(x, lowTable, highTable)));
+    }
+    mulAddLoop(dst + i, src + i, m, size - i);
+}
+
+__attribute__((target("ssse3")))
+static void mulScalarSSSE3(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    mulScalarLoopSSSE3(dst, src, m, size);
+}
+
+__attribute__((target("ssse3")))
+static void mulAddSSSE3(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    mulAddLoopSSSE3(dst, src, m, size);
+}
+
+__attribute__((target("ssse3")))
+static void mulAddRowsSSSE3(uint8_t* accumulator, const uint8_t* coefficients, size_t count,
+        const uint8_t (*rows)[GF256_REGISTER_SIZE]) {
+    __m128i low = _mm_loadu_si128((const __m128i*)accumulator);
+    __m128i high = _mm_loadu_si128((const __m128i*)(accumulator + 16));
+
+    for (size_t j = 0; j < count; j++) {
+        const GF256Multiplier* m = &multipliers[coefficients[j]];
+        __m128i lowTable = _mm_loadu_si128((const __m128i*)m->low);
+        __m128i highTable = _mm_loadu_si128((const __m128i*)m->high);
+        low = _mm_xor_si128(low, mulSSSE3(_mm_loadu_si128((const __m128i*)rows[j]), lowTable, highTable));
+        high = _mm_xor_si128(high,
+                mulSSSE3(_mm_loadu_si128((const __m128i*)(rows[j] + 16)), lowTable, highTable));
+    }
+
+    _mm_storeu_si128((__m128i*)accumulator, low);
+    _mm_storeu_si128((__m128i*)(accumulator + 16), high);
+}
+
+// The register stays in two XMM registers, shifting down one byte per step
+__attribute__((target("ssse3")))
+GF256_INLINE void remainderStepSSSE3(__m128i* low, __m128i* high, uint8_t codeword,
+        const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]) {
+    uint8_t feedback = codeword ^ (uint8_t)_mm_cvtsi128_si32(*low);
+    const uint8_t* row = feedbackRows[feedback];
+    *low = _mm_xor_si128(_mm_alignr_epi8(*high, *low, 1), _mm_loadu_si128((const __m128i*)row));
+    *high = _mm_xor_si128(_mm_srli_si128(*high, 1), _mm_loadu_si128((const __m128i*)(row + 16)));
+}
+
+__attribute__((target("ssse3")))
+static void polyRemainderSSSE3(uint8_t* remainder, const uint8_t* msg, size_t msgSize,
+        const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]) {
+    __m128i low = _mm_loadu_si128((const __m128i*)remainder);
+    __m128i high = _mm_loadu_si128((const __m128i*)(remainder + 16));
+
+    for (size_t i = 0; i < msgSize; i++)
+        remainderStepSSSE3(&low, &high, msg[i], feedbackRows);
+
+    _mm_storeu_si128((__m128i*)remainder, low);
+    _mm_storeu_si128((__m128i*)(remainder + 16), high);
+}
+
+__attribute__((target("ssse3")))
+static void polyRemaindersSSSE3(uint8_t (*remainders)[GF256_REGISTER_SIZE], const uint8_t* const* msgs,
+        size_t numMsgs, size_t msgSize, const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]) {
+    // Each step has to wait for the previous one, so four registers advance in
+    // lockstep to give the CPU independent work while a row load is in flight
+    size_t m = 0;
+    for (; m + 4 <= numMsgs; m += 4) {
+        __m128i low0 = _mm_loadu_si128((const __m128i*)remainders[m]);
+        __m128i high0 = _mm_loadu_si128((const __m128i*)(remainders[m] + 16));
+        __m128i low1 = _mm_loadu_si128((const __m128i*)remainders[m+1]);
+        __m128i high1 = _mm_loadu_si128((const __m128i*)(remainders[m+1] + 16));
+        __m128i low2 = _mm_loadu_si128((const __m128i*)remainders[m+2]);
+        __m128i high2 = _mm_loadu_si128((const __m128i*)(remainders[m+2] + 16));
+        __m128i low3 = _mm_loadu_si128((const __m128i*)remainders[m+3]);
+        __m128i high3 = _mm_loadu_si128((const __m128i*)(remainders[m+3] + 16));
+
+        for (size_t i = 0; i < msgSize; i++) {
+            remainderStepSSSE3(&low0, &high0, msgs[m][i], feedbackRows);
+            remainderStepSSSE3(&low1, &high1, msgs[m+1][i], feedbackRows);
+            remainderStepSSSE3(&low2, &high2, msgs[m+2][i], feedbackRows);
+            remainderStepSSSE3(&low3, &high3, msgs[m+3][i], feedbackRows);
+        }
+
+        _mm_storeu_si128((__m128i*)remainders[m], low0);
+        _mm_storeu_si128((__m128i*)(remainders[m] + 16), high0);
+        _mm_storeu_si128((__m128i*)remainders[m+1], low1);
+        _mm_storeu_si128((__m128i*)(remainders[m+1] + 16), high1);
+        _mm_storeu_si128((__m128i*)remainders[m+2], low2);
+        _mm_storeu_si128((__m128i*)(remainders[m+2] + 16), high2);
+        _mm_storeu_si128((__m128i*)remainders[m+3], low3);
+        _mm_storeu_si128((__m128i*)(remainders[m+3] + 16), high3);
+    }
+
+    for (; m < numMsgs; m++)
+        polyRemainderSSSE3(remainders[m], msgs[m], msgSize, feedbackRows);
+}
+
+__attribute__((target("avx2")))
+GF256_INLINE __m256i mulAVX2(__m256i x, __m256i lowTable, __m256i highTable) {
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_and_si256(x, nibbleMask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibbleMask);
+    return _mm256_xor_si256(_mm256_shuffle_epi8(lowTable, low), _mm256_shuffle_epi8(highTable, high));
+}
+
+__attribute__((target("avx2")))
+static void mulScalarAVX2(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m->low));
+    __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m->high));
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), mulAVX2(x, lowTable, highTable));
+    }
+    mulScalarLoopSSSE3(dst + i, src + i, m, size - i);
+}
+
+__attribute__((target("avx2")))
+static void mulAddAVX2(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m->low));
+    __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m->high));
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, mulAVX2(x, lowTable, highTable)));
+    }
+    mulAddLoopSSSE3(dst + i, src + i, m, size - i);
+}
+
+__attribute__((target("avx2")))
+static void mulAddRowsAVX2(uint8_t* accumulator, const uint8_t* coefficients, size_t count,
+        const uint8_t (*rows)[GF256_REGISTER_SIZE]) {
+    __m256i sum = _mm256_loadu_si256((const __m256i*)accumulator);
+
+    for (size_t j = 0; j < count; j++) {
+        const GF256Multiplier* m = &multipliers[coefficients[j]];
+        __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m->low));
+        __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m->high));
+        sum = _mm256_xor_si256(sum, mulAVX2(_mm256_loadu_si256((const __m256i*)rows[j]), lowTable, highTable));
+    }
+
+    _mm256_storeu_si256((__m256i*)accumulator, sum);
+}
+
+// GF2P8MULB is hardwired to the AES polynomial, so GFNI multiplies through
+// GF2P8AFFINEQB with the bit matrix of the multiplication instead
+
+__attribute__((target("avx2,gfni")))
+static void mulScalarGFNI(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    __m256i matrix = _mm256_set1_epi64x((long long)m->affine);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_gf2p8affine_epi64_epi8(x, matrix, 0));
+    }
+    mulScalarLoopSSSE3(dst + i, src + i, m, size - i);
+}
+
+__attribute__((target("avx2,gfni")))
+static void mulAddGFNI(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    __m256i matrix = _mm256_set1_epi64x((long long)m->affine);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                _mm256_xor_si256(d, _mm256_gf2p8affine_epi64_epi8(x, matrix, 0)));
+    }
+    mulAddLoopSSSE3(dst + i, src + i, m, size - i);
+}
+
+__attribute__((target("avx2,gfni")))
+static void mulAddRowsGFNI(uint8_t* accumulator, const uint8_t* coefficients, size_t count,
+        const uint8_t (*rows)[GF256_REGISTER_SIZE]) {
+    __m256i sum = _mm256_loadu_si256((const __m256i*)accumulator);
+
+    for (size_t j = 0; j < count; j++) {
+        __m256i matrix = _mm256_set1_epi64x((long long)multipliers[coefficients[j]].affine);
+        __m256i row = _mm256_loadu_si256((const __m256i*)rows[j]);
+        sum = _mm256_xor_si256(sum, _mm256_gf2p8affine_epi64_epi8(row, matrix, 0));
+    }
+
+    _mm256_storeu_si256((__m256i*)accumulator, sum);
+}
+#endif
+
+static const GF256KernelOps kernelOps[GF256_KERNEL_COUNT] = {
+    [GF256_KERNEL_SCALAR] = {"scalar", mulScalarScalar, mulAddScalar, mulAddRowsScalar, polyRemainderScalar, polyRemaindersScalar},
+#if defined(__x86_64__)
+    [GF256_KERNEL_SSSE3] = {"ssse3", mulScalarSSSE3, mulAddSSSE3, mulAddRowsSSSE3, polyRemainderSSSE3, polyRemaindersSSSE3},
+    // The remainder step is latency bound and shifting a YMM register by one
+    // byte needs a cross-lane permute, so the wider kernels keep the XMM version.
+    // It is a table lookup, so there is nothing for GFNI to multiply either.
+    [GF256_KERNEL_AVX2] = {"avx2", mulScalarAVX2, mulAddAVX2, mulAddRowsAVX2, polyRemainderSSSE3, polyRemaindersSSSE3},
+    [GF256_KERNEL_GFNI] = {"gfni", mulScalarGFNI, mulAddGFNI, mulAddRowsGFNI, polyRemainderSSSE3, polyRemaindersSSSE3},
+#else
+    [GF256_KERNEL_SSSE3] = {"ssse3", NULL, NULL, NULL, NULL, NULL},
+    [GF256_KERNEL_AVX2] = {"avx2", NULL, NULL, NULL, NULL, NULL},
+    [GF256_KERNEL_GFNI] = {"gfni", NULL, NULL, NULL, NULL, NULL},
+#endif
+};
+
+bool gf256KernelSupported(GF256Kernel kernel) {
+    switch (kernel) {
+        case GF256_KERNEL_SCALAR:
+            return true;
+#if defined(__x86_64__)
+        case GF256_KERNEL_SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case GF256_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case GF256_KERNEL_GFNI:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("gfni");
+#endif
+        default:
+            return false;
+    }
+}
+
+static void selectKernel(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+#endif
+    GF256Kernel best = GF256_KERNEL_SCALAR;
+    for (int k = GF256_KERNEL_SCALAR + 1; k < GF256_KERNEL_COUNT; k++) {
+        if (gf256KernelSupported(k))
+            best = k;
+    }
+    __atomic_store_n(&activeKernel, best, __ATOMIC_RELAXED);
+}
+
+static inline const GF256KernelOps* getKernelOps(void) {
+    pthread_once(&kernelSelectOnce, selectKernel);
+    return &kernelOps[__atomic_load_n(&activeKernel, __ATOMIC_RELAXED)];
+}
+
+bool gf256UseKernel(GF256Kernel kernel) {
+    // Mostly for benchmarks and cross checks, the CPU's best kernel is used by default
+    pthread_once(&kernelSelectOnce, selectKernel);
+    if (kernel >= GF256_KERNEL_COUNT || !gf256KernelSupported(kernel))
+        return false;
+
+    __atomic_store_n(&activeKernel, kernel, __ATOMIC_RELAXED);
+    return true;
+}
+
+GF256Kernel gf256ActiveKernel(void) {
+    pthread_once(&kernelSelectOnce, selectKernel);
+    return __atomic_load_n(&activeKernel, __ATOMIC_RELAXED);
+}
+
+const char* gf256KernelName(GF256Kernel kernel) {
+    assert(kernel < GF256_KERNEL_COUNT);
+    return kernelOps[kernel].name;
+}
+
+void gf256MulScalar(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    getKernelOps()->mulScalar(dst, src, m, size);
+}
+
+void gf256MulAdd(uint8_t* dst, const uint8_t* src, const GF256Multiplier* m, size_t size) {
+    getKernelOps()->mulAdd(dst, src, m, size);
+}
+
+void gf256MulAddRows(uint8_t* accumulator, const uint8_t* coefficients, size_t count,
+        const uint8_t (*rows)[GF256_REGISTER_SIZE]) {
+    // The kernels read the shared multipliers directly
+    pthread_once(&multipliersOnce, buildMultipliers);
+    getKernelOps()->mulAddRows(accumulator, coefficients, count, rows);
+}
+
+void gf256PolyRemainder(uint8_t* remainder, const uint8_t* msg, size_t msgSize,
+        const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]) {
+    getKernelOps()->polyRemainder(remainder, msg, msgSize, feedbackRows);
+}
+
+void gf256PolyRemainders(uint8_t (*remainders)[GF256_REGISTER_SIZE], const uint8_t* const* msgs,
+        size_t numMsgs, size_t msgSize, const uint8_t (*feedbackRows)[GF256_REGISTER_SIZE]) {
+    getKernelOps()->polyRemainders(remainders, msgs, numMsgs, msgSize, feedbackRows);
+}
@@ -1,13 +1,20 @@
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "qrbitboard.h"
+#include "qrdecode.h"
 #include "qrencode.h"
 
 void printHelpMessage(const char* progName);
-char* readFile(char* filePath);
+uint8_t* readFile(char* filePath, size_t* length);
+bool parseUnsigned(const char* text, unsigned int* value);
 
 int main(int argc, char** argv) {
     ErrorCorrectionLevel ecLevel = EC_M;
@@ -17,12 +24,21 @@ int main(int argc, char** argv) {
     char* filePath = NULL;
     bool fileMode = false;
     bool invertColors = false;
+    bool verify = false;
+    QROptions options;
+    initQROptions(&options);
 
     const struct option long_options[] = {
         {"invert", no_argument, NULL, 'i'},
         {"file", required_argument, NULL, 'f'},
         {"help", no_argument, NULL, 0},
         {"verbose", no_argument, NULL, 'v'},
+        {"verify", no_argument, NULL, 'V'},
+        {"engine", required_argument, NULL, 'e'},
+        {"cross-check", no_argument, NULL, 'c'},
+        {"mask", required_argument, NULL, 'm'},
+        {"mask-threads", required_argument, NULL, 't'},
+        {"mask-threads-min-version", required_argument, NULL, 'T'},
         {0, 0, 0, 0},
     };
 
@@ -54,60 +70,132 @@ int main(int argc, char** argv) {
             case 'i':
                 invertColors = true;
                 break;
+            case 'V':
+                verify = true;
+                break;
+            case 'e':
+                if (strcmp(optarg, "fast") == 0) {
+                    options.engine = QR_ENGINE_FAST;
+                } else if (strcmp(optarg, "reference") == 0) {
+                    options.engine = QR_ENGINE_REFERENCE;
+                } else {
+                    fprintf(stderr, "Unknown engine '%s', expected 'fast' or 'reference'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                options.crossCheck = true;
+                break;
+            case 'm':
+                if (!parseQRMaskPolicy(optarg, &options)) {
+                    fprintf(stderr, "Unknown mask '%s', expected 'auto', 'fast' or a mask from 0 to 7\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                if (!parseUnsigned(optarg, &options.maskThreads) || options.maskThreads < 1) {
+                    fprintf(stderr, "--mask-threads must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                if (!parseUnsigned(optarg, &options.parallelMaskMinVersion) ||
+                        options.parallelMaskMinVersion < 1 || options.parallelMaskMinVersion > 40) {
+                    fprintf(stderr, "--mask-threads-min-version must be between 1 and 40\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             default:
                 fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
 
-    char* message = NULL;
+    if (options.maskPolicy == QR_MASK_FAST && (options.engine == QR_ENGINE_REFERENCE || options.crossCheck)) {
+        fprintf(stderr, "--mask=fast only works with the fast engine and without --cross-check\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t* message = NULL;
+    size_t messageLength = 0;
     bool stdinMode = optind >= argc; // No argument provided - read from stdin
 
     if (fileMode) {
         if (verbose)
             printf("Input file path: %s\n", filePath);
-        message = readFile(filePath);
+        message = readFile(filePath, &messageLength);
     } else if (stdinMode) {
-        message = (char*)malloc(sizeof(char) * (MAX_QR_CHARS + 1));
+        message = (uint8_t*)malloc(sizeof(uint8_t) * MAX_QR_CHARS);
         if (message == NULL) {
             perror("main() - failed to malloc");
             exit(EXIT_FAILURE);
         }
 
-        int offset = 0;
-        while(fgets(message + offset, MAX_QR_CHARS + 1 - offset, stdin)) {
-            offset = strnlen(message, MAX_QR_CHARS);
-            if (offset == MAX_QR_CHARS)
-                break;
-        }
+        // Read raw bytes so embedded NULs survive
+        size_t bytesRead;
+        while (messageLength < MAX_QR_CHARS &&
+               (bytesRead = fread(message + messageLength, 1, MAX_QR_CHARS - messageLength, stdin)) > 0)
+            messageLength += bytesRead;
     } else {
         // Read data from a positional argument
-        size_t argSize = strnlen(argv[optind], MAX_QR_CHARS);
-        message = (char*)malloc(sizeof(char) * (argSize + 1));
+        messageLength = strnlen(argv[optind], MAX_QR_CHARS);
+        message = (uint8_t*)malloc(sizeof(uint8_t) * (messageLength + 1));
         if (message == NULL) {
             perror("main() - failed to malloc");
             exit(EXIT_FAILURE);
         }
-        strncpy(message, argv[optind], argSize);
+        memcpy(message, argv[optind], messageLength);
     }
 
+    EncodingPlan plan = planEncodingBytes(message, messageLength, ecLevel);
+
     // Truncate data if necessary
-    unsigned int maxQRCharacters = getMaxQRCharacters(message, ecLevel);
-    unsigned int messageLength = (unsigned int)strnlen(message, MAX_QR_CHARS);
+    if (plan.capacity < plan.length) {
+        messageLength = plan.capacity;
 
-    if (maxQRCharacters < messageLength) {
-        message = realloc(message, sizeof(char) * (maxQRCharacters + 1));
-        message[maxQRCharacters] = 0;
+        // The truncated message may fit a more compact mode, so plan it again
+        plan = planEncodingBytes(message, messageLength, ecLevel);
 
-        fprintf(stderr, "Warning: Data truncated to %d characters\n", maxQRCharacters);
+        fprintf(stderr, "Warning: Data truncated to %zu characters\n", messageLength);
         fprintf(stderr, "Try reducing the error correction level to increase character capacity\n");
     }
 
-    QR* qr = createQRCode(message, ecLevel);
+    QR* qr = createQRCodeWithOptions(message, &plan, &options);
 
     if (verbose) {
-        printf("Message: %s\n", message);
+        printf("Message: ");
+        fwrite(message, 1, messageLength, stdout);
+        printf("\n");
         printf("Version %d - Size: %dx%d\n", qr->version, qr->width, qr->width);
+        char maskPolicy[8];
+        formatQRMaskPolicy(maskPolicy, sizeof(maskPolicy), &options);
+        printf("Engine: %s%s, mask: %s\n", getQREngineName(options.engine),
+                options.crossCheck ? " (cross-checked)" : "", maskPolicy);
+    }
+
+    if (verify) {
+        // Read the symbol back and make sure it decodes to exactly what went in
+        uint8_t* decoded = (uint8_t*)malloc(sizeof(uint8_t) * MAX_QR_CHARS);
+        if (decoded == NULL) {
+            perror("main() - failed to malloc");
+            exit(EXIT_FAILURE);
+        }
+
+        QRDecodeResult result = decodeQR(qr, decoded, MAX_QR_CHARS);
+        if (result.status != QR_DECODE_OK) {
+            fprintf(stderr, "Error: QR code failed verification: %s\n", getQRDecodeStatusString(result.status));
+            exit(EXIT_FAILURE);
+        }
+        if (result.length != messageLength || memcmp(decoded, message, messageLength) != 0) {
+            fprintf(stderr, "Error: QR code failed verification: decoded data does not match the input\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (verbose)
+            printf("Verified - decodes back to the input\n");
+
+        free(decoded);
+        decoded = NULL;
     }
 
     free(message);
@@ -117,7 +205,10 @@ int main(int argc, char** argv) {
     // TODO: Provide functionality to save QR as an image file
     // TODO: Encode data more efficiently by using different encoding blocks
     // e.g. encode some data with numeric encoding, other with byte encoding, etc.
-    printQR(qr, invertColors);
+    // The symbol is rendered from its bitboard, a word of modules at a time
+    QRBitboard* bb = packQRBitboard(qr);
+    printQRBitboard(bb, invertColors);
+    freeQRBitboard(bb);
 
     freeQR(qr);
     qr = NULL;
@@ -138,6 +229,15 @@ void printHelpMessage(const char* progName) {
     printf("  -f FILE, --file=FILE\n");
     printf("                    create QR from file\n");
     printf("  -v, --verbose     print verbose output\n");
+    printf("  --verify          decode the QR code and check it matches the input\n");
+    printf("  --engine=ENGINE   encoder to use, 'fast' (default) or 'reference'\n");
+    printf("  --cross-check     also encode with the other engine and abort if they differ\n");
+    printf("  --mask=MASK       how to pick the mask: 'auto' (default) for the lowest penalty,\n");
+    printf("                    'fast' for a quicker guess, or a mask number from 0 to 7\n");
+    printf("  --mask-threads=N  score the mask candidates on N threads (default 1)\n");
+    printf("  --mask-threads-min-version=V\n");
+    printf("                    smallest version scored on several threads (default %d)\n",
+            DEFAULT_PARALLEL_MASK_MIN_VERSION);
     printf("  --help            display this help message\n");
     printf("\nNotes:\n");
     printf("  If no message argument or file is provided, %s reads from standard input.\n", progName);
@@ -149,10 +249,10 @@ void printHelpMessage(const char* progName) {
     printf("  ls | %s\n", progName);
 }
 
-char* readFile(char* filePath) {
+uint8_t* readFile(char* filePath, size_t* length) {
     int rc = 0;
 
-    FILE* fd = fopen(filePath, "r");
+    FILE* fd = fopen(filePath, "rb");
     if (fd == NULL) {
         perror(filePath);
         exit(EXIT_FAILURE);
@@ -176,18 +276,17 @@ char* readFile(char* filePath) {
     if (fileLength > MAX_QR_CHARS)
         fileLength = MAX_QR_CHARS;
 
-    char* dataBuffer = (char*)malloc(sizeof(char) * (fileLength + 1));
+    uint8_t* dataBuffer = (uint8_t*)malloc(sizeof(uint8_t) * (fileLength + 1));
     if (dataBuffer == NULL) {
         perror("readFile() - failed to malloc");
         exit(EXIT_FAILURE);
     }
 
     // Read the entire file into dataBuffer -- up to fileLength bytes
-    int offset = 0;
-    while(fgets(dataBuffer + offset, fileLength + 1 - offset, fd)) {
-        offset = strnlen(dataBuffer, fileLength);
-        if (offset == fileLength)
-            break;
+    *length = fread(dataBuffer, 1, fileLength, fd);
+    if (ferror(fd)) {
+        perror("readFile() - error reading file");
+        exit(EXIT_FAILURE);
     }
 
     rc = fclose(fd);
@@ -198,3 +297,19 @@ char* readFile(char* filePath) {
 
     return dataBuffer;
 }
+
+bool parseUnsigned(const char* text, unsigned int* value) {
+    // strtoul() accepts a sign and wraps negative numbers around, so only
+    // plain digits are let through
+    if (!isdigit((unsigned char)text[0]))
+        return false;
+
+    char* end;
+    errno = 0;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (errno != 0 || *end != '\0' || parsed > UINT_MAX)
+        return false;
+
+    *value = parsed;
+    return true;
+}
@@ -3,9 +3,9 @@
 Polynomial* createPolynomial(size_t size) {
     assert(size > 0);
     Polynomial* p = (Polynomial*)malloc(sizeof(Polynomial));
-    p->data = (unsigned int*)malloc(sizeof(unsigned int) * size);;
+    p->data = (uint8_t*)malloc(sizeof(uint8_t) * size);
     p->size = size;
-    memset(p->data, 0, sizeof(unsigned int) * size);
+    memset(p->data, 0, sizeof(uint8_t) * size);
     return p;
 }
 
@@ -20,9 +20,7 @@ void freePolynomial(Polynomial* p) {
 
 Polynomial* copyPolynomial(Polynomial* p) {
     Polynomial* newPolynomial = createPolynomial(p->size);
-
-    for (int i = 0; i < p->size; i++)
-        newPolynomial->data[i] = p->data[i];
+    memcpy(newPolynomial->data, p->data, sizeof(uint8_t) * p->size);
 
     return newPolynomial;
 }
@@ -38,13 +36,19 @@ Polynomial* slicePolynomial(Polynomial* p, unsigned int start, unsigned int end)
     size_t size = end - start;
 
     Polynomial* newPolynomial = createPolynomial(size);
-
-    for (int i = 0; i < size; i++)
-        newPolynomial->data[i] = p->data[start+i];
+    memcpy(newPolynomial->data, p->data + start, sizeof(uint8_t) * size);
 
     return newPolynomial;
 }
 
+PolynomialView viewPolynomial(const Polynomial* p, unsigned int start, unsigned int end) {
+    assert(start < end);
+    assert(end <= p->size);
+
+    PolynomialView view = {p->data + start, end - start};
+    return view;
+}
+
 void printPolynomial(Polynomial* p) {
     size_t size = p->size;
     for (int i = 0; i < size; i++) {
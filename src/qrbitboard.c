@@ -0,0 +1,983 @@
+#include "qrbitboard.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static inline void packSixteenModules(const uint8_t* modules, uint64_t* low, uint64_t* high) {
+    // Gathers bits 0 and 1 of sixteen module bytes, module j landing on bit j
+#if defined(__x86_64__)
+    __m128i bytes = _mm_loadu_si128((const __m128i*)modules);
+    *low = (uint16_t)_mm_movemask_epi8(_mm_slli_epi64(bytes, 7));
+    *high = (uint16_t)_mm_movemask_epi8(_mm_slli_epi64(bytes, 6));
+#else
+    // The multiply moves one bit from each of eight bytes into the top byte
+    const uint64_t lsbs = 0x0101010101010101ull;
+    const uint64_t gather = 0x0102040810204080ull;
+    *low = *high = 0;
+    for (int half = 0; half < 2; half++) {
+        uint64_t bytes;
+        memcpy(&bytes, modules + 8 * half, 8);
+        *low |= ((((bytes & lsbs) * gather) >> 56)) << (8 * half);
+        *high |= (((((bytes >> 1) & lsbs) * gather) >> 56)) << (8 * half);
+    }
+#endif
+}
+
+void packQRScoringPlanes(QRScoringPlanes* planes, const QR* qr) {
+    unsigned int width = qr->width;
+    planes->width = width;
+    memset(planes->low, 0, sizeof(planes->low));
+    memset(planes->high, 0, sizeof(planes->high));
+
+    // The last chunk of a row is padded with light modules, which leave both
+    // planes clear
+    uint8_t padded[16];
+    memset(padded, MODULE_FUNCTION, sizeof(padded));
+    unsigned int tail = width % 16;
+
+    for (unsigned int i = 0; i < width; i++) {
+        const uint8_t* row = qr->data + i * width;
+        for (unsigned int j = 0; j < width; j += 16) {
+            const uint8_t* modules = row + j;
+            if (j + 16 > width) {
+                memcpy(padded, row + j, tail);
+                modules = padded;
+            }
+
+            uint64_t low, high;
+            packSixteenModules(modules, &low, &high);
+            planes->low[i][j / 64] |= low << (j % 64);
+            planes->high[i][j / 64] |= high << (j % 64);
+        }
+    }
+}
+
+QRMaskPlanes* createQRMaskPlanes(const QR* blank) {
+    unsigned int width = blank->width;
+    size_t numRows = 8 * width;
+    QRMaskPlanes* masks = (QRMaskPlanes*)calloc(1, sizeof(QRMaskPlanes) + sizeof(masks->rows[0]) * numRows);
+    if (masks == NULL) {
+        perror("createQRMaskPlanes() - failed to calloc");
+        exit(EXIT_FAILURE);
+    }
+    masks->width = width;
+
+    for (unsigned int maskType = 0; maskType < 8; maskType++) {
+        for (unsigned int i = 0; i < width; i++) {
+            uint64_t* row = masks->rows[maskType * width + i];
+            for (unsigned int j = 0; j < width; j++)
+                if (!isFunctionModule(blank, i, j) && maskCondition(maskType, i, j))
+                    row[j / 64] |= (uint64_t)1 << (j % 64);
+        }
+    }
+
+    return masks;
+}
+
+void applyMaskScoringPlanes(QRScoringPlanes* dest, const QRScoringPlanes* src, const QRMaskPlanes* masks,
+        unsigned int maskType) {
+    assert(maskType <= 7);
+    assert(masks->width == src->width);
+
+    if (dest != src) {
+        dest->width = src->width;
+        memcpy(dest->high, src->high, sizeof(dest->high));
+        memset(dest->low + src->width, 0, sizeof(dest->low[0]) * (MAX_BITBOARD_ROWS - src->width));
+    }
+
+    for (unsigned int i = 0; i < src->width; i++) {
+        const uint64_t* maskRow = getMaskPlaneRow(masks, maskType, i);
+        for (unsigned int k = 0; k < MAX_BITBOARD_ROW_WORDS; k++)
+            dest->low[i][k] = src->low[i][k] ^ maskRow[k];
+    }
+}
+
+static inline uint64_t spreadBitsToBytes(uint64_t bits) {
+    // Byte k of the result is bit k of the low byte of bits. Copying the byte
+    // everywhere and keeping bit k in byte k leaves each byte either 0 or a
+    // single bit, which the add carries up into bit 7 without crossing bytes.
+    uint64_t x = ((bits & 0xFF) * 0x0101010101010101ull) & 0x8040201008040201ull;
+    return ((x + 0x7F7F7F7F7F7F7F7Full) >> 7) & 0x0101010101010101ull;
+}
+
+void applyMaskPlanes(QR* dest, const QR* src, const QRMaskPlanes* masks, unsigned int maskType) {
+    // XORs eight module bytes at a time, the mask planes never touch
+    // function modules, so those keep their flag
+    assert(maskType <= 7);
+    assert(masks->width == src->width);
+
+    unsigned int width = src->width;
+    for (unsigned int i = 0; i < width; i++) {
+        const uint64_t* maskRow = getMaskPlaneRow(masks, maskType, i);
+        const uint8_t* srcRow = src->data + i * width;
+        uint8_t* destRow = dest->data + i * width;
+
+        unsigned int j = 0;
+        for (; j + 8 <= width; j += 8) {
+            uint64_t modules;
+            memcpy(&modules, srcRow + j, 8);
+            modules ^= spreadBitsToBytes(maskRow[j / 64] >> (j % 64));
+            memcpy(destRow + j, &modules, 8);
+        }
+        for (; j < width; j++)
+            destRow[j] = srcRow[j] ^ ((maskRow[j / 64] >> (j % 64)) & 1);
+    }
+}
+
+void initQRBitboard(QRBitboard* bb, unsigned int version, uint64_t* modules) {
+    assert(version > 0);
+    assert(version < 41);
+
+    bb->version = version;
+    bb->width = 4 * version + 17;
+    bb->rowWords = (bb->width + 63) / 64;
+    bb->modules = modules;
+    bb->function = getQRTemplate(version)->functionPlane;
+    memset(modules, 0, sizeof(uint64_t) * bb->width * bb->rowWords);
+}
+
+QRBitboard* createQRBitboard(unsigned int version) {
+    unsigned int width = 4 * version + 17;
+    size_t planeWords = (size_t)width * ((width + 63) / 64);
+
+    // The module plane is stored directly after the struct in one allocation,
+    // the function plane belongs to the template
+    QRBitboard* bb = (QRBitboard*)malloc(sizeof(QRBitboard) + sizeof(uint64_t) * planeWords);
+    if (bb == NULL) {
+        perror("createQRBitboard() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    initQRBitboard(bb, version, (uint64_t*)(bb + 1));
+
+    return bb;
+}
+
+QRBitboard* copyQRBitboard(const QRBitboard* bb) {
+    QRBitboard* newBB = createQRBitboard(bb->version);
+    memcpy(newBB->modules, bb->modules, sizeof(uint64_t) * bb->width * bb->rowWords);
+    return newBB;
+}
+
+void freeQRBitboard(QRBitboard* bb) {
+    // The module plane is part of the same allocation as the struct
+    bb->modules = NULL;
+    free(bb);
+}
+
+bool equalQRBitboards(const QRBitboard* a, const QRBitboard* b) {
+    // The padding bits are always clear, so whole words can be compared
+    return a->version == b->version &&
+        memcmp(a->modules, b->modules, sizeof(uint64_t) * a->width * a->rowWords) == 0;
+}
+
+static uint64_t* createTemplatePlane(const QR* blank, bool reserved) {
+    unsigned int width = blank->width;
+    unsigned int rowWords = (width + 63) / 64;
+    uint64_t* plane = (uint64_t*)calloc((size_t)width * rowWords, sizeof(uint64_t));
+    if (plane == NULL) {
+        perror("createTemplatePlane() - failed to calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // The reserved format (2) and version (3) modules are the only function
+    // modules with bit 1 set, the unset data modules have it too
+    for (unsigned int i = 0; i < width; i++) {
+        for (unsigned int j = 0; j < width; j++) {
+            bool set = isFunctionModule(blank, i, j) && (!reserved || (getModule(blank, i, j) & 2) != 0);
+            if (set)
+                plane[i * rowWords + j / 64] |= (uint64_t)1 << (j % 64);
+        }
+    }
+
+    return plane;
+}
+
+uint64_t* createFunctionPlane(const QR* blank) {
+    return createTemplatePlane(blank, false);
+}
+
+uint64_t* createReservedPlane(const QR* blank) {
+    return createTemplatePlane(blank, true);
+}
+
+void packQRBitboardInto(QRBitboard* bb, const QR* qr) {
+    assert(bb->version == qr->version);
+
+    // The last chunk of a row is padded with light modules, which keeps the
+    // padding bits clear
+    uint8_t padded[16];
+    memset(padded, MODULE_FUNCTION, sizeof(padded));
+    unsigned int width = qr->width;
+    unsigned int tail = width % 16;
+
+    for (unsigned int i = 0; i < width; i++) {
+        const uint8_t* row = qr->data + i * width;
+        uint64_t* bbRow = bb->modules + i * bb->rowWords;
+        memset(bbRow, 0, sizeof(uint64_t) * bb->rowWords);
+        for (unsigned int j = 0; j < width; j += 16) {
+            const uint8_t* modules = row + j;
+            if (j + 16 > width) {
+                memcpy(padded, row + j, tail);
+                modules = padded;
+            }
+
+            uint64_t low, high;
+            packSixteenModules(modules, &low, &high);
+            bbRow[j / 64] |= low << (j % 64);
+        }
+    }
+}
+
+QRBitboard* packQRBitboard(const QR* qr) {
+    QRBitboard* bb = createQRBitboard(qr->version);
+    packQRBitboardInto(bb, qr);
+    return bb;
+}
+
+QR* unpackQRBitboard(const QRBitboard* bb) {
+    QR* qr = initQR(bb->version);
+
+    // Eight modules at a time, a byte never straddles two words
+    unsigned int width = bb->width;
+    for (unsigned int i = 0; i < width; i++) {
+        const uint64_t* moduleRow = getBitboardRow(bb->modules, bb, i);
+        const uint64_t* functionRow = getBitboardRow(bb->function, bb, i);
+        uint8_t* row = qr->data + i * width;
+
+        for (unsigned int j = 0; j < width; j += 8) {
+            uint64_t modules = spreadBitsToBytes(moduleRow[j / 64] >> (j % 64)) |
+                spreadBitsToBytes(functionRow[j / 64] >> (j % 64)) << 7;
+            memcpy(row + j, &modules, MIN(8, width - j));
+        }
+    }
+
+    return qr;
+}
+
+void applyMaskBitboard(QRBitboard* bb, const QRMaskPlanes* masks, unsigned int maskType) {
+    // The mask planes never touch function modules
+    assert(maskType <= 7);
+    assert(masks->width == bb->width);
+
+    for (unsigned int i = 0; i < bb->width; i++) {
+        const uint64_t* maskRow = getMaskPlaneRow(masks, maskType, i);
+        for (unsigned int k = 0; k < bb->rowWords; k++)
+            bb->modules[i * bb->rowWords + k] ^= maskRow[k];
+    }
+}
+
+void addFormatInformationBitboard(QRBitboard* bb, ErrorCorrectionLevel ecLevel, unsigned int maskType) {
+    // Bit 14 of the format info comes first
+    unsigned int formatInfo = formatInfoLUT[ecLevel][maskType];
+    unsigned int width = bb->width;
+
+    for (unsigned int i = 0; i < 15; i++) {
+        bool bit = (formatInfo >> (14 - i)) & 1;
+
+        // Copy #1 around the top left finder pattern
+        if (i < 6)
+            setBitboardModule(bb->modules, bb, 8, i, bit);
+        else if (i < 8)
+            setBitboardModule(bb->modules, bb, 8, i + 1, bit);
+        else if (i == 8)
+            setBitboardModule(bb->modules, bb, 7, 8, bit);
+        else
+            setBitboardModule(bb->modules, bb, 14 - i, 8, bit);
+
+        // Copy #2 next to the bottom left and top right finder patterns
+        if (i < 7)
+            setBitboardModule(bb->modules, bb, width - i - 1, 8, bit);
+        else
+            setBitboardModule(bb->modules, bb, 8, width - 15 + i, bit);
+    }
+}
+
+void addVersionInformationBitboard(QRBitboard* bb) {
+    // Only v7 or greater QR codes have version information
+    if (bb->version < 7)
+        return;
+
+    unsigned int versionInfo = versionInfoLUT[bb->version];
+    unsigned int width = bb->width;
+
+    // Bit i * 3 + j goes to row width - 11 + j, column i of copy #1 and the
+    // transposed position of copy #2
+    for (unsigned int i = 0; i < 6; i++) {
+        for (unsigned int j = 0; j < 3; j++) {
+            bool bit = (versionInfo >> (i * 3 + j)) & 1;
+            setBitboardModule(bb->modules, bb, width - 11 + j, i, bit);
+            setBitboardModule(bb->modules, bb, i, width - 11 + j, bit);
+        }
+    }
+}
+
+void packQRScoringPlanesBitboard(QRScoringPlanes* planes, const QRBitboard* bb, const uint64_t* reserved) {
+    // The reserved modules are the high plane, their bit 0 is already in the
+    // module plane
+    planes->width = bb->width;
+    memset(planes->low, 0, sizeof(planes->low));
+    memset(planes->high, 0, sizeof(planes->high));
+
+    for (unsigned int i = 0; i < bb->width; i++) {
+        memcpy(planes->low[i], getBitboardRow(bb->modules, bb, i), sizeof(uint64_t) * bb->rowWords);
+        if (reserved != NULL)
+            memcpy(planes->high[i], getBitboardRow(reserved, bb, i), sizeof(uint64_t) * bb->rowWords);
+    }
+}
+
+void printQRBitboard(const QRBitboard* bb, bool invertColors) {
+    char fullBlock[] = "██";
+    char spaces[] = "  ";
+    char* darkModule = invertColors ? fullBlock : spaces;
+    char* lightModule = invertColors ? spaces : fullBlock;
+
+    unsigned int width = bb->width;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < width + 8; j++)
+            fputs(lightModule, stdout);
+        fputs("\n", stdout);
+    }
+    for (int i = 0; i < width; i++) {
+        const uint64_t* row = getBitboardRow(bb->modules, bb, i);
+
+        for (int j = 0; j < 4; j++)
+            fputs(lightModule, stdout);
+
+        // Walk the row one word at a time, shifting out a module per column
+        for (int k = 0; k < bb->rowWords; k++) {
+            uint64_t word = row[k];
+            int numColumns = MIN(64, (int)width - 64 * k);
+            for (int j = 0; j < numColumns; j++) {
+                fputs((word & 1) ? darkModule : lightModule, stdout);
+                word >>= 1;
+            }
+        }
+
+        for (int j = 0; j < 4; j++)
+            fputs(lightModule, stdout);
+        fputs("\n", stdout);
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < width + 8; j++)
+            fputs(lightModule, stdout);
+        fputs("\n", stdout);
+    }
+}
+
+// Padded rows are MAX_BITBOARD_ROW_WORDS words, module j is bit j % 64 of word j / 64
+typedef uint64_t BitRow[MAX_BITBOARD_ROW_WORDS];
+
+// The helpers are forced inline so they pick up the POPCNT build of the scorers
+#define BITBOARD_INLINE static inline __attribute__((always_inline))
+
+#if defined(__x86_64__)
+// Scoring is mostly popcounts, which are a library call unless the compiler
+// may use the POPCNT instruction, so the scorers get a POPCNT clone as well
+#define BITBOARD_SCORER __attribute__((target_clones("popcnt", "default")))
+#else
+#define BITBOARD_SCORER
+#endif
+
+BITBOARD_INLINE void shiftRowDown(BitRow dest, const BitRow src, unsigned int k) {
+    // dest module j = src module j + k, for 0 < k < 64
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++) {
+        dest[w] = src[w] >> k;
+        if (w + 1 < MAX_BITBOARD_ROW_WORDS)
+            dest[w] |= src[w + 1] << (64 - k);
+    }
+}
+
+BITBOARD_INLINE void shiftRowUp(BitRow dest, const BitRow src, unsigned int k) {
+    // dest module j = src module j - k, for 0 < k < 64
+    for (unsigned int w = MAX_BITBOARD_ROW_WORDS; w-- > 0;) {
+        dest[w] = src[w] << k;
+        if (w > 0)
+            dest[w] |= src[w - 1] >> (64 - k);
+    }
+}
+
+BITBOARD_INLINE void andRows(BitRow dest, const BitRow a, const BitRow b) {
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+        dest[w] = a[w] & b[w];
+}
+
+BITBOARD_INLINE unsigned int popcountRow(const BitRow row) {
+    unsigned int count = 0;
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+        count += __builtin_popcountll(row[w]);
+    return count;
+}
+
+static void setLowBits(BitRow row, unsigned int numBits) {
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++) {
+        if (numBits >= 64 * (w + 1))
+            row[w] = ~0ull;
+        else if (numBits > 64 * w)
+            row[w] = ((uint64_t)1 << (numBits - 64 * w)) - 1;
+        else
+            row[w] = 0;
+    }
+}
+
+BITBOARD_INLINE void findEqualNeighbours(BitRow equal, const uint64_t* low, const uint64_t* high,
+        const BitRow validPairs) {
+    // Bit j is set when module j has the same value as module j + 1
+    BitRow nextLow, nextHigh;
+    shiftRowDown(nextLow, low, 1);
+    shiftRowDown(nextHigh, high, 1);
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+        equal[w] = ~((low[w] ^ nextLow[w]) | (high[w] ^ nextHigh[w])) & validPairs[w];
+}
+
+BITBOARD_INLINE unsigned int scoreRowRuns(const QRScoringPlanes* planes, unsigned int i, const BitRow validPairs,
+        BitRow equal) {
+    // A run of n >= 5 same coloured modules costs n - 2. Such a run has n - 4
+    // positions where five equal modules start, so the penalty is that count
+    // plus 2 for every run of those positions. equal gets the row's
+    // findEqualNeighbours().
+    BitRow pairs, five, shifted;
+    findEqualNeighbours(equal, planes->low[i], planes->high[i], validPairs);
+    shiftRowDown(shifted, equal, 1);
+    andRows(pairs, equal, shifted);
+    shiftRowDown(shifted, pairs, 2);
+    andRows(five, pairs, shifted);
+
+    shiftRowUp(shifted, five, 1);
+    unsigned int numRuns = 0;
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+        numRuns += __builtin_popcountll(five[w] & ~shifted[w]);
+    unsigned int score = popcountRow(five) + 2 * numRuns;
+
+    // scoreCondition1() starts every line as if a module of value 2 came
+    // before it, so a leading run of reserved format modules counts one
+    // module longer
+    if ((planes->high[i][0] & ~planes->low[i][0] & 1) != 0) {
+        unsigned int runLength = 1;
+        for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS && runLength == 64 * w + 1; w++)
+            runLength += ~equal[w] == 0 ? 64 : __builtin_ctzll(~equal[w]);
+        score += runLength == 4 ? 3 : runLength >= 5 ? 1 : 0;
+    }
+
+    return score;
+}
+
+BITBOARD_INLINE void findDarkLight(BitRow dark, BitRow light, const QRScoringPlanes* planes, unsigned int i,
+        const BitRow valid) {
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++) {
+        dark[w] = planes->low[i][w] & ~planes->high[i][w];
+        light[w] = ~(planes->low[i][w] | planes->high[i][w]) & valid[w];
+    }
+}
+
+BITBOARD_INLINE unsigned int scoreRowPatterns(const BitRow dark, const BitRow light) {
+    // 10111010000 and 00001011101 are the 1011101 core with four light
+    // modules after or before it. Only dark (1) modules match a 1 and only
+    // light (0) modules match a 0. Both planes are zero past the width, so no
+    // match can run off the end of a line.
+    BitRow shifted;
+
+    // Bit j of core is set when the core starts at module j
+    BitRow darkThree, core;
+    shiftRowDown(shifted, dark, 1);
+    andRows(darkThree, dark, shifted);
+    shiftRowDown(shifted, dark, 2);
+    andRows(darkThree, darkThree, shifted);
+    shiftRowDown(shifted, light, 1);
+    andRows(core, dark, shifted);
+    shiftRowDown(shifted, darkThree, 2);
+    andRows(core, core, shifted);
+    shiftRowDown(shifted, light, 5);
+    andRows(core, core, shifted);
+    shiftRowDown(shifted, dark, 6);
+    andRows(core, core, shifted);
+
+    // Bit j of lightFour is set when modules j to j + 3 are light
+    BitRow lightTwo, lightFour;
+    shiftRowDown(shifted, light, 1);
+    andRows(lightTwo, light, shifted);
+    shiftRowDown(shifted, lightTwo, 2);
+    andRows(lightFour, lightTwo, shifted);
+
+    BitRow match;
+    unsigned int score = 0;
+    shiftRowDown(shifted, lightFour, 7);
+    andRows(match, core, shifted);
+    score += 40 * popcountRow(match);
+    shiftRowUp(shifted, lightFour, 4);
+    andRows(match, core, shifted);
+    score += 40 * popcountRow(match);
+
+    return score;
+}
+
+BITBOARD_INLINE void findEqualRows(BitRow equal, const QRScoringPlanes* planes, unsigned int i) {
+    // Bit j is set when module (i, j) has the same value as module (i + 1, j)
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+        equal[w] = ~((planes->low[i][w] ^ planes->low[i + 1][w]) | (planes->high[i][w] ^ planes->high[i + 1][w]));
+}
+
+// Conditions 1, 2 and 3 are scored a row at a time: row i adds its own runs
+// and patterns, the column runs and patterns that start on it and the 2x2
+// blocks it is the bottom of. Columns are
+// handled all at once, bit j of row i standing for module (i, j), so shifts
+// along a row become row offsets. The rows the columns need are kept in rings
+// indexed by row modulo the ring size.
+#define SCAN_LIGHT_ROWS 16  // rows i - 4 to i + 10
+#define SCAN_EQUAL_ROWS 8   // rows i - 1 to i + 3
+
+typedef struct RowScan {
+    BitRow valid;
+    BitRow validPairs;
+    BitRow dark[SCAN_LIGHT_ROWS];
+    BitRow light[SCAN_LIGHT_ROWS];
+    BitRow equal[SCAN_EQUAL_ROWS];  // findEqualRows() masked to the width
+    BitRow previousFive;            // five equal modules starting on row i - 1
+    BitRow previousNeighbours;      // findEqualNeighbours() of row i - 1
+} RowScan;
+
+BITBOARD_INLINE void loadScanRow(RowScan* scan, const QRScoringPlanes* planes, unsigned int i) {
+    // Rows past the end are light nowhere, so no pattern runs off the matrix
+    if (i < planes->width)
+        findDarkLight(scan->dark[i % SCAN_LIGHT_ROWS], scan->light[i % SCAN_LIGHT_ROWS], planes, i, scan->valid);
+    else
+        memset(scan->light[i % SCAN_LIGHT_ROWS], 0, sizeof(BitRow));
+}
+
+BITBOARD_INLINE void loadScanEqualRow(RowScan* scan, const QRScoringPlanes* planes, unsigned int i) {
+    BitRow* equal = &scan->equal[i % SCAN_EQUAL_ROWS];
+    if (i + 1 < planes->width) {
+        findEqualRows(*equal, planes, i);
+        andRows(*equal, *equal, scan->valid);
+    } else {
+        memset(*equal, 0, sizeof(BitRow));
+    }
+}
+
+BITBOARD_INLINE void startRowScan(RowScan* scan, const QRScoringPlanes* planes, unsigned int firstRow) {
+    // Scanning from a row other than 0 treats the rows above it as context
+    // only: column runs are counted from firstRow and blocks from firstRow - 1
+    setLowBits(scan->valid, planes->width);
+    setLowBits(scan->validPairs, planes->width - 1);
+    memset(scan->previousFive, 0, sizeof(BitRow));
+    if (firstRow > 0)
+        findEqualNeighbours(scan->previousNeighbours, planes->low[firstRow - 1], planes->high[firstRow - 1],
+                scan->validPairs);
+
+    // Rows above row 0 are outside the matrix
+    for (unsigned int i = firstRow + SCAN_LIGHT_ROWS - 4; i < firstRow + SCAN_LIGHT_ROWS; i++) {
+        if (i >= SCAN_LIGHT_ROWS)
+            loadScanRow(scan, planes, i - SCAN_LIGHT_ROWS);
+        else
+            memset(scan->light[i], 0, sizeof(BitRow));
+    }
+    for (unsigned int i = firstRow; i < firstRow + 10; i++)
+        loadScanRow(scan, planes, i);
+    for (unsigned int i = firstRow; i < firstRow + 3; i++)
+        loadScanEqualRow(scan, planes, i);
+}
+
+BITBOARD_INLINE unsigned int scoreColumnRuns(RowScan* scan, const QRScoringPlanes* planes, unsigned int i) {
+    // Same count as scoreRowRuns(), for the five equal modules starting on row i
+    const BitRow* equal = scan->equal;
+    BitRow five;
+    andRows(five, equal[i % SCAN_EQUAL_ROWS], equal[(i + 1) % SCAN_EQUAL_ROWS]);
+    andRows(five, five, equal[(i + 2) % SCAN_EQUAL_ROWS]);
+    andRows(five, five, equal[(i + 3) % SCAN_EQUAL_ROWS]);
+
+    unsigned int numRuns = 0;
+    for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+        numRuns += __builtin_popcountll(five[w] & ~scan->previousFive[w]);
+    unsigned int score = popcountRow(five) + 2 * numRuns;
+    memcpy(scan->previousFive, five, sizeof(BitRow));
+
+    if (i == 0) {
+        // Columns that start with a reserved format module (2), see scoreRowRuns()
+        BitRow run, longerRun;
+        for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+            run[w] = planes->high[0][w] & ~planes->low[0][w] & equal[0][w] & equal[1][w] & equal[2][w];
+        andRows(longerRun, run, equal[3]);
+        for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+            score += 3 * __builtin_popcountll(run[w] & ~longerRun[w]) + __builtin_popcountll(longerRun[w]);
+    }
+
+    return score;
+}
+
+BITBOARD_INLINE unsigned int scoreColumnPatterns(const RowScan* scan, const QRScoringPlanes* planes,
+        unsigned int i) {
+    // Same matches as scoreRowPatterns(), for the cores starting on row i.
+    // Light rows outside the matrix are zero in the ring, so matches that
+    // would run off either end never count.
+    if (i + 7 > planes->width)
+        return 0;
+
+#define DARK(k) scan->dark[(i + (k)) % SCAN_LIGHT_ROWS]
+#define LIGHT(k) scan->light[(i + (k)) % SCAN_LIGHT_ROWS]
+    BitRow core;
+    andRows(core, DARK(0), LIGHT(1));
+    andRows(core, core, DARK(2));
+    andRows(core, core, DARK(3));
+    andRows(core, core, DARK(4));
+    andRows(core, core, LIGHT(5));
+    andRows(core, core, DARK(6));
+
+    unsigned int score = 0;
+    BitRow match;
+    andRows(match, core, LIGHT(7));
+    andRows(match, match, LIGHT(8));
+    andRows(match, match, LIGHT(9));
+    andRows(match, match, LIGHT(10));
+    score += 40 * popcountRow(match);
+    andRows(match, core, LIGHT(SCAN_LIGHT_ROWS - 4));
+    andRows(match, match, LIGHT(SCAN_LIGHT_ROWS - 3));
+    andRows(match, match, LIGHT(SCAN_LIGHT_ROWS - 2));
+    andRows(match, match, LIGHT(SCAN_LIGHT_ROWS - 1));
+    score += 40 * popcountRow(match);
+#undef DARK
+#undef LIGHT
+
+    return score;
+}
+
+BITBOARD_INLINE unsigned int scoreBlocks(const BitRow neighbours, const BitRow nextNeighbours,
+        const BitRow equalRows) {
+    // A 2x2 block is one colour when both rows match their right neighbour
+    // and the top row matches the bottom one
+    BitRow blocks;
+    andRows(blocks, neighbours, nextNeighbours);
+    andRows(blocks, blocks, equalRows);
+    return 3 * popcountRow(blocks);
+}
+
+BITBOARD_INLINE unsigned int scanRow(RowScan* scan, const QRScoringPlanes* planes, unsigned int i) {
+    // Returns the condition 1, 2 and 3 penalties row i adds, condition 2
+    // counting the blocks whose bottom row it is. Rows must be scanned in
+    // order from startRowScan().
+    loadScanRow(scan, planes, i + 10);
+    loadScanEqualRow(scan, planes, i + 3);
+
+    BitRow neighbours;
+    unsigned int score = scoreRowRuns(planes, i, scan->validPairs, neighbours);
+    if (i > 0)
+        score += scoreBlocks(scan->previousNeighbours, neighbours, scan->equal[(i - 1) % SCAN_EQUAL_ROWS]);
+    memcpy(scan->previousNeighbours, neighbours, sizeof(BitRow));
+
+    const BitRow* dark = &scan->dark[i % SCAN_LIGHT_ROWS];
+    const BitRow* light = &scan->light[i % SCAN_LIGHT_ROWS];
+    return score + scoreColumnRuns(scan, planes, i) + scoreRowPatterns(*dark, *light) +
+        scoreColumnPatterns(scan, planes, i);
+}
+
+BITBOARD_INLINE unsigned int countDarkModules(const QRScoringPlanes* planes) {
+    unsigned int numDarkModules = 0;
+    for (unsigned int i = 0; i < planes->width; i++)
+        for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++)
+            numDarkModules += __builtin_popcountll(planes->low[i][w] & ~planes->high[i][w]);
+
+    return numDarkModules;
+}
+
+BITBOARD_INLINE unsigned int countMaskedDarkModules(const QRScoringPlanes* planes, const QRMaskPlanes* masks,
+        unsigned int maskType) {
+    // countDarkModules() of the planes with the mask applied, without applying it
+    unsigned int numDarkModules = 0;
+    for (unsigned int i = 0; i < planes->width; i++) {
+        const uint64_t* maskRow = getMaskPlaneRow(masks, maskType, i);
+        for (unsigned int w = 0; w < MAX_BITBOARD_ROW_WORDS; w++) {
+            uint64_t low = planes->low[i][w] ^ maskRow[w];
+            numDarkModules += __builtin_popcountll(low & ~planes->high[i][w]);
+        }
+    }
+
+    return numDarkModules;
+}
+
+BITBOARD_SCORER
+unsigned int scoreCondition1Bitboard(const QRScoringPlanes* planes) {
+    RowScan scan;
+    startRowScan(&scan, planes, 0);
+
+    unsigned int score = 0;
+    for (unsigned int i = 0; i < planes->width; i++) {
+        loadScanEqualRow(&scan, planes, i + 3);
+        BitRow neighbours;
+        score += scoreRowRuns(planes, i, scan.validPairs, neighbours) + scoreColumnRuns(&scan, planes, i);
+    }
+
+    return score;
+}
+
+BITBOARD_SCORER
+unsigned int scoreCondition2Bitboard(const QRScoringPlanes* planes) {
+    BitRow validPairs;
+    setLowBits(validPairs, planes->width - 1);
+
+    unsigned int score = 0;
+    BitRow neighbours, nextNeighbours, equalRows;
+    findEqualNeighbours(neighbours, planes->low[0], planes->high[0], validPairs);
+    for (unsigned int i = 0; i + 1 < planes->width; i++) {
+        findEqualNeighbours(nextNeighbours, planes->low[i + 1], planes->high[i + 1], validPairs);
+        findEqualRows(equalRows, planes, i);
+        score += scoreBlocks(neighbours, nextNeighbours, equalRows);
+        memcpy(neighbours, nextNeighbours, sizeof(BitRow));
+    }
+
+    return score;
+}
+
+BITBOARD_SCORER
+unsigned int scoreCondition3Bitboard(const QRScoringPlanes* planes) {
+    RowScan scan;
+    startRowScan(&scan, planes, 0);
+
+    unsigned int score = 0;
+    for (unsigned int i = 0; i < planes->width; i++) {
+        loadScanRow(&scan, planes, i + 10);
+        score += scoreRowPatterns(scan.dark[i % SCAN_LIGHT_ROWS], scan.light[i % SCAN_LIGHT_ROWS]) +
+            scoreColumnPatterns(&scan, planes, i);
+    }
+
+    return score;
+}
+
+BITBOARD_SCORER
+unsigned int scoreCondition4Bitboard(const QRScoringPlanes* planes) {
+    return scoreDarkModuleRatio(countDarkModules(planes), planes->width * planes->width);
+}
+
+BITBOARD_SCORER
+unsigned int scoreQRBitboard(const QRScoringPlanes* planes) {
+    unsigned int score = scoreDarkModuleRatio(countDarkModules(planes), planes->width * planes->width);
+
+    RowScan scan;
+    startRowScan(&scan, planes, 0);
+    for (unsigned int i = 0; i < planes->width; i++)
+        score += scanRow(&scan, planes, i);
+
+    return score;
+}
+
+// One mask search, shared by every thread working on it. Masks are compared
+// by score << 3 | mask number, so the lower key always wins and ties go to the
+// lower mask without a special case.
+typedef struct MaskSearch {
+    const QRScoringPlanes* planes;
+    const QRMaskPlanes* masks;
+    unsigned int firstRow;          // rows scored for conditions 1 to 3
+    unsigned int endRow;
+    unsigned int bounds[8];
+    unsigned int order[8];
+    atomic_uint next;               // position in order of the next mask to score
+    atomic_uint_least64_t bestKey;
+    atomic_uint rowsScanned;
+    atomic_uint numPruned;
+} MaskSearch;
+
+static inline uint64_t getMaskKey(unsigned int score, unsigned int maskType) {
+    return (uint64_t)score << 3 | maskType;
+}
+
+BITBOARD_SCORER
+static void startMaskSearch(MaskSearch* search, const QRScoringPlanes* planes, const QRMaskPlanes* masks,
+        unsigned int firstRow, unsigned int endRow) {
+    // Condition 4 only needs a popcount, so it comes first and gives every
+    // mask a lower bound, which is also the order the masks are tried in
+    unsigned int numModules = planes->width * planes->width;
+
+    search->planes = planes;
+    search->masks = masks;
+    search->firstRow = firstRow;
+    search->endRow = endRow;
+    for (unsigned int maskType = 0; maskType < 8; maskType++) {
+        search->bounds[maskType] =
+            scoreDarkModuleRatio(countMaskedDarkModules(planes, masks, maskType), numModules);
+
+        // Insertion sort on the bound, equal bounds stay in mask order
+        unsigned int k = maskType;
+        for (; k > 0 && search->bounds[search->order[k - 1]] > search->bounds[maskType]; k--)
+            search->order[k] = search->order[k - 1];
+        search->order[k] = maskType;
+    }
+
+    atomic_init(&search->next, 0);
+    atomic_init(&search->bestKey, UINT64_MAX);
+    atomic_init(&search->rowsScanned, 0);
+    atomic_init(&search->numPruned, 0);
+}
+
+BITBOARD_SCORER
+static void runMaskSearch(MaskSearch* search, QRScoringPlanes* scratch) {
+    // Takes masks off the search until there are none left. Conditions 2, 1
+    // and 3 are added to a mask's bound a row at a time, and the mask is
+    // dropped as soon as its partial penalty can no longer beat the best one,
+    // so over every row the result is the same as scoring every mask in full.
+    const QRScoringPlanes* planes = search->planes;
+    unsigned int k;
+    while ((k = atomic_fetch_add(&search->next, 1)) < 8) {
+        unsigned int maskType = search->order[k];
+        unsigned int score = search->bounds[maskType];
+        if (getMaskKey(score, maskType) >= atomic_load_explicit(&search->bestKey, memory_order_relaxed)) {
+            atomic_fetch_add(&search->numPruned, 1);
+            continue;
+        }
+
+        applyMaskScoringPlanes(scratch, planes, search->masks, maskType);
+        RowScan scan;
+        startRowScan(&scan, scratch, search->firstRow);
+        unsigned int i = search->firstRow;
+        while (i < search->endRow &&
+                getMaskKey(score, maskType) < atomic_load_explicit(&search->bestKey, memory_order_relaxed))
+            score += scanRow(&scan, scratch, i++);
+        atomic_fetch_add(&search->rowsScanned, i - search->firstRow);
+        if (scratch == planes)
+            applyMaskScoringPlanes(scratch, scratch, search->masks, maskType);
+
+        uint64_t key = getMaskKey(score, maskType);
+        uint64_t bestKey = atomic_load(&search->bestKey);
+        bool isBest = false;
+        while (key < bestKey && !(isBest = atomic_compare_exchange_weak(&search->bestKey, &bestKey, key)))
+            ;
+        if (!isBest)
+            atomic_fetch_add(&search->numPruned, 1);
+    }
+}
+
+// Worker threads for findBestMaskScoringPlanes(). They are started the first
+// time they are needed and then live as long as the process, waiting for the
+// next search. Only one search uses them at a time.
+typedef struct MaskPool {
+    pthread_mutex_t inUse;      // held by the thread whose search the workers run
+    pthread_mutex_t lock;       // protects everything below
+    pthread_cond_t searchReady;
+    pthread_cond_t searchDone;
+    MaskSearch* search;
+    unsigned long generation;   // bumped for every search
+    unsigned int numWorkers;
+    unsigned int numHelpers;    // workers taking part in the current search
+    unsigned int numRunning;    // workers not done with the current search
+} MaskPool;
+
+static MaskPool maskPool = {
+    .inUse = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .searchReady = PTHREAD_COND_INITIALIZER,
+    .searchDone = PTHREAD_COND_INITIALIZER,
+};
+
+typedef struct MaskWorker {
+    unsigned int index;
+    unsigned long seen;         // last generation the worker took part in
+    QRScoringPlanes scratch;
+} MaskWorker;
+
+static void* runMaskWorker(void* arg) {
+    MaskWorker* worker = (MaskWorker*)arg;
+
+    pthread_mutex_lock(&maskPool.lock);
+    for (;;) {
+        while (maskPool.generation == worker->seen)
+            pthread_cond_wait(&maskPool.searchReady, &maskPool.lock);
+        worker->seen = maskPool.generation;
+        MaskSearch* search = worker->index < maskPool.numHelpers ? maskPool.search : NULL;
+        pthread_mutex_unlock(&maskPool.lock);
+
+        if (search != NULL)
+            runMaskSearch(search, &worker->scratch);
+
+        pthread_mutex_lock(&maskPool.lock);
+        if (--maskPool.numRunning == 0)
+            pthread_cond_signal(&maskPool.searchDone);
+    }
+
+    return NULL;
+}
+
+static void startMaskWorkers(unsigned int numWorkers) {
+    // Called with maskPool.inUse held, so no search is running. A new worker
+    // starts from the current generation, so it can't miss the next search
+    // however late it gets scheduled.
+    pthread_mutex_lock(&maskPool.lock);
+    while (maskPool.numWorkers < numWorkers) {
+        MaskWorker* worker = (MaskWorker*)malloc(sizeof(MaskWorker));
+        if (worker == NULL) {
+            perror("startMaskWorkers() - failed to malloc");
+            exit(EXIT_FAILURE);
+        }
+        worker->index = maskPool.numWorkers;
+        worker->seen = maskPool.generation;
+
+        pthread_t thread;
+        int rc = pthread_create(&thread, NULL, runMaskWorker, worker);
+        if (rc != 0) {
+            errno = rc;
+            perror("startMaskWorkers() - failed to create thread");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+        maskPool.numWorkers++;
+    }
+    pthread_mutex_unlock(&maskPool.lock);
+}
+
+static unsigned int finishMaskSearch(MaskSearch* search, QRMaskSearchStats* stats) {
+    if (stats != NULL) {
+        stats->symbols++;
+        stats->masksPruned += atomic_load(&search->numPruned);
+        stats->matrixPasses += 8 + (double)atomic_load(&search->rowsScanned) / search->planes->width;
+    }
+
+    return atomic_load(&search->bestKey) & 7;
+}
+
+unsigned int findBestMaskScoringPlanes(QRScoringPlanes* planes, const QRMaskPlanes* masks,
+        unsigned int numThreads, QRMaskSearchStats* stats) {
+    MaskSearch search;
+    startMaskSearch(&search, planes, masks, 0, planes->width);
+
+    if (numThreads > MAX_MASK_THREADS)
+        numThreads = MAX_MASK_THREADS;
+
+    // The calling thread scores masks as well. If another search has the
+    // workers, this one runs on its own rather than waiting for them.
+    if (numThreads > 1 && pthread_mutex_trylock(&maskPool.inUse) == 0) {
+        startMaskWorkers(numThreads - 1);
+
+        pthread_mutex_lock(&maskPool.lock);
+        maskPool.search = &search;
+        maskPool.numHelpers = numThreads - 1;
+        maskPool.numRunning = maskPool.numWorkers;
+        maskPool.generation++;
+        pthread_cond_broadcast(&maskPool.searchReady);
+        pthread_mutex_unlock(&maskPool.lock);
+
+        QRScoringPlanes scratch;
+        runMaskSearch(&search, &scratch);
+
+        pthread_mutex_lock(&maskPool.lock);
+        while (maskPool.numRunning > 0)
+            pthread_cond_wait(&maskPool.searchDone, &maskPool.lock);
+        maskPool.search = NULL;
+        pthread_mutex_unlock(&maskPool.lock);
+        pthread_mutex_unlock(&maskPool.inUse);
+    } else {
+        // On a single thread the masks go on and come off planes in place
+        runMaskSearch(&search, planes);
+    }
+
+    return finishMaskSearch(&search, stats);
+}
+
+unsigned int findFastMaskScoringPlanes(QRScoringPlanes* planes, const QRMaskPlanes* masks,
+        QRMaskSearchStats* stats) {
+    // Condition 4 over the whole symbol, the rest over a band of rows across
+    // the middle, where there are the fewest function patterns
+    unsigned int numRows = MIN(planes->width, FAST_MASK_ROWS);
+    unsigned int firstRow = (planes->width - numRows) / 2;
+
+    MaskSearch search;
+    startMaskSearch(&search, planes, masks, firstRow, firstRow + numRows);
+    runMaskSearch(&search, planes);
+
+    return finishMaskSearch(&search, stats);
+}
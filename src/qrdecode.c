@@ -0,0 +1,284 @@
+#include "qrdecode.h"
+
+static const char alphanumericChars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+static unsigned int readModuleBit(const QR* qr, unsigned int row, unsigned int col) {
+    return getModule(qr, row, col) & 1;
+}
+
+static bool readFormatInformation(const QR* qr, ErrorCorrectionLevel* ecLevel, unsigned int* maskType) {
+    // Both copies are read in the order addFormatInformation() writes them
+    unsigned int copy1 = 0;
+    unsigned int copy2 = 0;
+    unsigned int width = qr->width;
+    for (int i = 0; i < 15; i++) {
+        unsigned int bit1;
+        if (i < 6)
+            bit1 = readModuleBit(qr, 8, i);
+        else if (i < 8)
+            bit1 = readModuleBit(qr, 8, i + 1);
+        else if (i == 8)
+            bit1 = readModuleBit(qr, 7, 8);
+        else
+            bit1 = readModuleBit(qr, 14 - i, 8);
+
+        unsigned int bit2 = i < 7 ? readModuleBit(qr, width - i - 1, 8) : readModuleBit(qr, 8, width - 15 + i);
+
+        copy1 = (copy1 << 1) | bit1;
+        copy2 = (copy2 << 1) | bit2;
+    }
+
+    // There are only 32 format codewords, so the closest one to either copy
+    // is found by brute force
+    unsigned int bestDistance = UINT_MAX;
+    for (int ec = EC_L; ec <= EC_H; ec++) {
+        for (unsigned int mask = 0; mask < 8; mask++) {
+            unsigned int distance = MIN(__builtin_popcount(copy1 ^ formatInfoLUT[ec][mask]),
+                    __builtin_popcount(copy2 ^ formatInfoLUT[ec][mask]));
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                *ecLevel = ec;
+                *maskType = mask;
+            }
+        }
+    }
+
+    return bestDistance <= MAX_FORMAT_INFO_ERRORS;
+}
+
+static bool readVersionInformation(const QR* qr, unsigned int* version) {
+    // Bit k of the version codeword is stored at the module
+    // addVersionInformation() puts versionInfoString[k] on
+    unsigned int copy1 = 0;
+    unsigned int copy2 = 0;
+    unsigned int width = qr->width;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 6; j++) {
+            copy1 |= readModuleBit(qr, width - 11 + i, j) << (j * 3 + i);
+            copy2 |= readModuleBit(qr, j, width - 11 + i) << (j * 3 + i);
+        }
+    }
+
+    unsigned int bestDistance = UINT_MAX;
+    for (unsigned int v = 7; v <= 40; v++) {
+        unsigned int distance = MIN(__builtin_popcount(copy1 ^ versionInfoLUT[v]),
+                __builtin_popcount(copy2 ^ versionInfoLUT[v]));
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            *version = v;
+        }
+    }
+
+    return bestDistance <= MAX_VERSION_INFO_ERRORS;
+}
+
+static void readCodewords(const QR* qr, unsigned int maskType, uint8_t* codewords, size_t numCodewords) {
+    // The template's data module table is the zigzag walk, so codeword k is
+    // the unmasked value of modules 8k to 8k + 7
+    const QRTemplate* qrTemplate = getQRTemplate(qr->version);
+    const uint16_t* offsets = qrTemplate->dataModuleOffsets;
+    assert(numCodewords * 8 <= qrTemplate->numDataModules);
+
+    for (size_t k = 0; k < numCodewords; k++) {
+        uint8_t codeword = 0;
+        for (int i = 0; i < 8; i++) {
+            unsigned int offset = offsets[k * 8 + i];
+            unsigned int bit = (qr->data[offset] & 1) ^
+                maskCondition(maskType, offset / qr->width, offset % qr->width);
+            codeword = (codeword << 1) | bit;
+        }
+        codewords[k] = codeword;
+    }
+}
+
+static QRDecodeStatus correctBlocks(const uint8_t* message, unsigned int qrVersion,
+        ErrorCorrectionLevel ecLevel, uint8_t* dataCodewords, unsigned int* correctedCodewords) {
+    // Gathers each block out of the interleaved message, corrects it and
+    // writes its data codewords back in block order
+    const uint16_t* positions = getQRTemplate(qrVersion)->codewordPositions[ecLevel];
+    const unsigned int numGroup1Blocks = dataBlocksInGroup1LUT[qrVersion][ecLevel];
+    const unsigned int numBlocks = numGroup1Blocks + dataBlocksInGroup2LUT[qrVersion][ecLevel];
+    const unsigned int numECCodewords = ecCodewordsPerBlockLUT[qrVersion][ecLevel];
+    const unsigned int totalDataCodewords = totalDataCodewordsLUT[qrVersion][ecLevel];
+
+    uint8_t block[RS_MAX_CODEWORDS];
+    unsigned int blockStart = 0;
+    *correctedCodewords = 0;
+    for (unsigned int b = 0; b < numBlocks; b++) {
+        unsigned int blockSize = b < numGroup1Blocks ? dataCodewordsPerGroup1BlockLUT[qrVersion][ecLevel] :
+            dataCodewordsPerGroup2BlockLUT[qrVersion][ecLevel];
+
+        for (unsigned int j = 0; j < blockSize; j++)
+            block[j] = message[positions[blockStart + j]];
+        for (unsigned int j = 0; j < numECCodewords; j++)
+            block[blockSize + j] = message[positions[totalDataCodewords + b * numECCodewords + j]];
+
+        int corrected = rsDecodeBlock(block, blockSize + numECCodewords, numECCodewords, NULL, 0);
+        if (corrected == RS_DECODE_FAILURE)
+            return QR_DECODE_UNCORRECTABLE;
+        *correctedCodewords += corrected;
+
+        memcpy(dataCodewords + blockStart, block, sizeof(uint8_t) * blockSize);
+        blockStart += blockSize;
+    }
+
+    return QR_DECODE_OK;
+}
+
+static bool readSegmentBits(BitStream* bs, unsigned int numBits, uint32_t* value) {
+    if (bs->cursor + numBits > bs->size)
+        return false;
+
+    *value = readBits(bs, numBits);
+    return true;
+}
+
+static QRDecodeStatus readSegments(BitStream* bs, unsigned int qrVersion, uint8_t* payload,
+        size_t payloadCapacity, size_t* length) {
+    *length = 0;
+
+    // A symbol may hold several segments, the terminator (or running out of
+    // room for another mode indicator) ends the stream
+    while (bs->size - bs->cursor >= 4) {
+        unsigned int modeIndicator = readBits(bs, 4);
+        EncodingMode mode;
+        switch (modeIndicator) {
+            case 0b0000:
+                return QR_DECODE_OK;
+            case 0b0001:
+                mode = MODE_NUMERIC;
+                break;
+            case 0b0010:
+                mode = MODE_ALPHANUMERIC;
+                break;
+            case 0b0100:
+                mode = MODE_BYTE;
+                break;
+            default:
+                return QR_DECODE_BAD_SEGMENT;
+        }
+
+        uint32_t count;
+        if (!readSegmentBits(bs, getCharacterCountBits(mode, qrVersion), &count))
+            return QR_DECODE_BAD_SEGMENT;
+        if (*length + count > payloadCapacity)
+            return QR_DECODE_OVERFLOW;
+
+        uint8_t* out = payload + *length;
+        uint32_t value;
+        size_t i = 0;
+        switch (mode) {
+            case MODE_NUMERIC:
+                for (; i + 3 <= count; i += 3) {
+                    if (!readSegmentBits(bs, 10, &value) || value >= 1000)
+                        return QR_DECODE_BAD_SEGMENT;
+                    out[i] = '0' + value / 100;
+                    out[i+1] = '0' + value / 10 % 10;
+                    out[i+2] = '0' + value % 10;
+                }
+                if (count - i == 2) {
+                    if (!readSegmentBits(bs, 7, &value) || value >= 100)
+                        return QR_DECODE_BAD_SEGMENT;
+                    out[i] = '0' + value / 10;
+                    out[i+1] = '0' + value % 10;
+                } else if (count - i == 1) {
+                    if (!readSegmentBits(bs, 4, &value) || value >= 10)
+                        return QR_DECODE_BAD_SEGMENT;
+                    out[i] = '0' + value;
+                }
+                break;
+            case MODE_ALPHANUMERIC:
+                for (; i + 2 <= count; i += 2) {
+                    if (!readSegmentBits(bs, 11, &value) || value >= 45 * 45)
+                        return QR_DECODE_BAD_SEGMENT;
+                    out[i] = alphanumericChars[value / 45];
+                    out[i+1] = alphanumericChars[value % 45];
+                }
+                if (count - i == 1) {
+                    if (!readSegmentBits(bs, 6, &value) || value >= 45)
+                        return QR_DECODE_BAD_SEGMENT;
+                    out[i] = alphanumericChars[value];
+                }
+                break;
+            default:
+                for (; i < count; i++) {
+                    if (!readSegmentBits(bs, 8, &value))
+                        return QR_DECODE_BAD_SEGMENT;
+                    out[i] = value;
+                }
+                break;
+        }
+        *length += count;
+    }
+
+    return QR_DECODE_OK;
+}
+
+QRDecodeResult decodeQR(const QR* qr, uint8_t* payload, size_t payloadCapacity) {
+    QRDecodeResult result = {0};
+
+    if (qr->width < 21 || qr->width > MAX_QR_WIDTH || (qr->width - 17) % 4 != 0) {
+        result.status = QR_DECODE_BAD_SIZE;
+        return result;
+    }
+    unsigned int qrVersion = (qr->width - 17) / 4;
+    result.version = qrVersion;
+
+    if (!readFormatInformation(qr, &result.ecLevel, &result.maskType)) {
+        result.status = QR_DECODE_BAD_FORMAT;
+        return result;
+    }
+
+    // Small symbols have no version information, their width says it all
+    unsigned int versionInfo;
+    if (qrVersion >= 7 && (!readVersionInformation(qr, &versionInfo) || versionInfo != qrVersion)) {
+        result.status = QR_DECODE_BAD_VERSION;
+        return result;
+    }
+
+    // The reader only trusts module values, so a copy with the right version
+    // is used to look up the template
+    QR symbol = *qr;
+    symbol.version = qrVersion;
+
+    ErrorCorrectionLevel ecLevel = result.ecLevel;
+    unsigned int numBlocks = dataBlocksInGroup1LUT[qrVersion][ecLevel] + dataBlocksInGroup2LUT[qrVersion][ecLevel];
+    unsigned int totalDataCodewords = totalDataCodewordsLUT[qrVersion][ecLevel];
+    unsigned int totalCodewords = totalDataCodewords + ecCodewordsPerBlockLUT[qrVersion][ecLevel] * numBlocks;
+
+    uint8_t message[MAX_DATA_CODEWORDS + MAX_EC_CODEWORDS];
+    readCodewords(&symbol, result.maskType, message, totalCodewords);
+
+    uint8_t dataCodewords[MAX_DATA_CODEWORDS];
+    result.status = correctBlocks(message, qrVersion, ecLevel, dataCodewords, &result.correctedCodewords);
+    if (result.status != QR_DECODE_OK)
+        return result;
+
+    // initBitStream() clears the buffer, so the stream is set up over the
+    // corrected codewords by hand
+    BitStream stream = {dataCodewords, totalDataCodewords, totalDataCodewords * 8, 0, false};
+    result.status = readSegments(&stream, qrVersion, payload, payloadCapacity, &result.length);
+
+    return result;
+}
+
+const char* getQRDecodeStatusString(QRDecodeStatus status) {
+    switch (status) {
+        case QR_DECODE_OK:
+            return "ok";
+        case QR_DECODE_BAD_SIZE:
+            return "invalid symbol size";
+        case QR_DECODE_BAD_FORMAT:
+            return "unreadable format information";
+        case QR_DECODE_BAD_VERSION:
+            return "unreadable version information";
+        case QR_DECODE_UNCORRECTABLE:
+            return "too many errors to correct";
+        case QR_DECODE_BAD_SEGMENT:
+            return "malformed data segment";
+        case QR_DECODE_OVERFLOW:
+            return "payload too large";
+    }
+
+    return "unknown error";
+}
@@ -1,137 +1,155 @@
 #include "qrencode.h"
+#include "qrbitboard.h"
+
+static bool isAlphanumericChar(uint8_t c) {
+    // strchr() would match the string's own terminator for a 0x00 byte
+    return isdigit(c) || isupper(c) || (c != 0 && strchr(" $%*+-./:", c) != NULL);
+}
+
+static unsigned int getCharacterCapacity(EncodingMode encodingMode, unsigned int qrVersion,
+        ErrorCorrectionLevel ecLevel) {
+    switch (encodingMode) {
+        case MODE_NUMERIC:
+            return numericCharCapacityLUT[qrVersion][ecLevel];
+        case MODE_ALPHANUMERIC:
+            return alphanumericCharCapacityLUT[qrVersion][ecLevel];
+        case MODE_BYTE:
+            return byteCharCapacityLUT[qrVersion][ecLevel];
+        case MODE_KANJI:
+            return kanjiCharCapacityLUT[qrVersion][ecLevel];
+        case MODE_ECI:
+            break;
+    }
+
+    return 0;
+}
+
+unsigned int getCharacterCountBits(EncodingMode encodingMode, unsigned int qrVersion) {
+    assert(qrVersion >= 1 && qrVersion <= 40);
+    assert(encodingMode <= MODE_KANJI);
+
+    // Versions 1-9, 10-26 and 27-40 use increasingly long character counts
+    if (qrVersion <= 9)
+        return characterCountBitsLUT[encodingMode][0];
+    else if (qrVersion <= 26)
+        return characterCountBitsLUT[encodingMode][1];
+    else
+        return characterCountBitsLUT[encodingMode][2];
+}
+
+static unsigned int getPayloadBits(EncodingMode encodingMode, size_t dataLength) {
+    switch (encodingMode) {
+        case MODE_NUMERIC:
+            // 10 bits per group of 3 digits, then 4 or 7 bits for the last 1 or 2 digits
+            if (dataLength % 3 == 1)
+                return 10 * (dataLength / 3) + 4;
+            else if (dataLength % 3 == 2)
+                return 10 * (dataLength / 3) + 7;
+            return 10 * (dataLength / 3);
+        case MODE_ALPHANUMERIC:
+            // 11 bits per pair of characters, then 6 bits for a final odd character
+            return 11 * (dataLength / 2) + 6 * (dataLength % 2);
+        case MODE_BYTE:
+            return 8 * dataLength;
+        case MODE_KANJI:
+            return 13 * dataLength;
+        case MODE_ECI:
+            break;
+    }
+
+    assert(0);
+    return 0;
+}
 
 // TODO: Add Kanji and ECI support
-static EncodingMode calculateEncodingMode(char* data) {
-    size_t dataLength = strnlen(data, MAX_QR_CHARS);
+EncodingPlan planEncodingBytes(const uint8_t* data, size_t dataLength, ErrorCorrectionLevel ecLevel) {
+    EncodingPlan plan;
+    plan.ecLevel = ecLevel;
 
     // Step through data and determine what kind of encoding to use
-    // based on the characters in the string
+    // based on the characters in the data
     EncodingMode encodingMode = MODE_NUMERIC;
-    for (int i = 0; i < dataLength; i++) {
-        char c = data[i];
+    for (size_t i = 0; i < dataLength && encodingMode != MODE_BYTE; i++) {
+        uint8_t c = data[i];
         if (encodingMode == MODE_NUMERIC) {
             if (isdigit(c) == 0)
                 encodingMode = MODE_ALPHANUMERIC;
         }
 
         if (encodingMode == MODE_ALPHANUMERIC) {
-            if (!(isdigit(c) || isupper(c)) && (strchr(" $%*+-./:", c) == NULL))
+            if (!isAlphanumericChar(c))
                 encodingMode = MODE_BYTE;
         }
-
-        if (encodingMode == MODE_BYTE)
-            return encodingMode;
     }
+    plan.mode = encodingMode;
+    plan.length = dataLength;
 
-    return encodingMode;
-}
-
-unsigned int calculateQRVersion(char* data, ErrorCorrectionLevel ecLevel) {
-    size_t dataLength = strnlen(data, MAX_QR_CHARS);
-
-	unsigned int qrVersion = 0;
-
-    EncodingMode encodingMode = calculateEncodingMode(data);
-	
+    // The data is too big to fit into the largest QR code if no version fits.
+    // We will truncate the data to fit the largest QR later
+    plan.version = 40;
     for (int i = 1; i < 41; i++) {
-        unsigned int maxCharacters = 0;
-        switch (encodingMode) {
-            case MODE_NUMERIC:
-                maxCharacters = numericCharCapacityLUT[i][ecLevel];
-                break;
-            case MODE_ALPHANUMERIC:
-                maxCharacters = alphanumericCharCapacityLUT[i][ecLevel];
-                break;
-            case MODE_BYTE:
-                maxCharacters = byteCharCapacityLUT[i][ecLevel];
-                break;
-            case MODE_KANJI:
-                maxCharacters = kanjiCharCapacityLUT[i][ecLevel];
-                break;
-            case MODE_ECI:
-                break;
-        }
-        if (maxCharacters >= dataLength) {
-            qrVersion = i;
+        if (getCharacterCapacity(encodingMode, i, ecLevel) >= dataLength) {
+            plan.version = i;
             break;
         }
     }
 
-    // The data is too big to fit into the largest QR code.
-    // We will truncate the data to fit the largest QR later
-    if (qrVersion == 0) {
-        qrVersion = 40;
-    }
+    plan.capacity = getCharacterCapacity(encodingMode, plan.version, ecLevel);
+    plan.bitCount = 4 + getCharacterCountBits(encodingMode, plan.version) +
+        getPayloadBits(encodingMode, dataLength);
 
-    return qrVersion;
-};
+    return plan;
+}
 
-static void convertToBitStream(unsigned int data, int numBits, linkedlist* dataStream) {
-    for (int i = 0; i < numBits; i++) {
-        unsigned int shiftDistance = numBits - i - 1;
-        unsigned char bit = (data >> shiftDistance) & 1;
-        addLinkedListNode(dataStream, bit);
-    }
+EncodingPlan planEncoding(char* data, ErrorCorrectionLevel ecLevel) {
+    return planEncodingBytes((const uint8_t*)data, strnlen(data, MAX_QR_CHARS), ecLevel);
+}
+
+unsigned int calculateQRVersionBytes(const uint8_t* data, size_t dataLength,
+        ErrorCorrectionLevel ecLevel) {
+    return planEncodingBytes(data, dataLength, ecLevel).version;
 }
 
-static void numericEncoding(char* data, linkedlist* dataStream, int qrVersion) {
-    unsigned char modeIndicator[] = {0, 0, 0, 1};
+unsigned int calculateQRVersion(char* data, ErrorCorrectionLevel ecLevel) {
+    return planEncoding(data, ecLevel).version;
+};
 
-    for (int i = 0; i < 4; i++)
-        addLinkedListNode(dataStream, modeIndicator[i]);
+static void numericEncoding(const uint8_t* data, const EncodingPlan* plan, BitStream* dataStream) {
+    // Write the 4 bit mode indicator
+    appendBits(dataStream, 0b0001, 4);
 
-    size_t dataLength = strnlen(data, MAX_QR_CHARS);
+    size_t dataLength = plan->length;
 
     assert(dataLength > 0);
-    assert(qrVersion >= 1 && qrVersion <= 40);
-
-    int numBits;
-    if (qrVersion <= 9) {
-        // 10 bit character count
-        numBits = 10;
-    } else if (qrVersion >= 10 && qrVersion <= 26) {
-        // 12 bit character count
-        numBits = 12;
-    } else {
-        // 14 bit character count
-        numBits = 14;
-    }
 
     // Write data length to the data stream
-    convertToBitStream(dataLength, numBits, dataStream);
+    appendBits(dataStream, dataLength, getCharacterCountBits(MODE_NUMERIC, plan->version));
 
-    // Write groups of 3 digits to the data stream
+    // Write groups of 3 digits to the data stream. Each group always takes 10
+    // bits, even when it has leading zeros.
     for (int i = 0; i < dataLength / 3; i++) {
-        char threeDigitNum[4] = {0};
-        strncpy(threeDigitNum, &data[3*i], 3);
+        const uint8_t* digits = &data[3*i];
 
-        unsigned int num = atoi(threeDigitNum);
+        unsigned int num = 100 * (digits[0] - '0') + 10 * (digits[1] - '0') + (digits[2] - '0');
 
-        numBits = 10;
-        if (num < 100)
-            numBits = 7;
-        if (num < 10)
-            numBits = 4;
-
-        convertToBitStream(num, numBits, dataStream);
+        appendBits(dataStream, num, 10);
     }
 
     if (dataLength % 3 == 0)
         return;
 
     // Encode the remaining 1 or 2 digits
-    char lastDigits[4] = {0};
-    strncpy(lastDigits, &data[(dataLength / 3) * 3], 3);
-    unsigned int num = atoi(lastDigits);
-    if (num < 10)
-        numBits = 4;
-    else
-        numBits = 7;
+    unsigned int num = 0;
+    for (size_t i = (dataLength / 3) * 3; i < dataLength; i++)
+        num = 10 * num + (data[i] - '0');
 
-    convertToBitStream(num, numBits, dataStream);
+    if (dataLength % 3 == 1)
+        appendBits(dataStream, num, 4);
+    else
+        appendBits(dataStream, num, 7);
 }
 
-static unsigned int getAlphanumericCode(char c) {
+static unsigned int getAlphanumericCode(uint8_t c) {
     // Convert from ASCII to QR Alphanumeric
 
     if (c >= 48 && c <= 57) // Digits 0-9
@@ -166,31 +184,16 @@ static unsigned int getAlphanumericCode(char c) {
     return 0;
 }
 
-static void alphanumericEncoding(char* data, linkedlist* dataStream, int qrVersion) {
-    unsigned char modeIndicator[] = {0, 0, 1, 0};
+static void alphanumericEncoding(const uint8_t* data, const EncodingPlan* plan, BitStream* dataStream) {
+    // Write the 4 bit mode indicator
+    appendBits(dataStream, 0b0010, 4);
 
-    for (int i = 0; i < 4; i++)
-        addLinkedListNode(dataStream, modeIndicator[i]);
-
-    size_t dataLength = strnlen(data, MAX_QR_CHARS);
+    size_t dataLength = plan->length;
 
     assert(dataLength > 0);
-    assert(qrVersion >= 1 && qrVersion <= 40);
-
-    int numBits;
-    if (qrVersion <= 9) {
-        // 9 bit character count
-        numBits = 9;
-    } else if (qrVersion >= 10 && qrVersion <= 26) {
-        // 11 bit character count
-        numBits = 11;
-    } else {
-        // 13 bit character count
-        numBits = 13;
-    }
 
     // Write data length to the data stream
-    convertToBitStream(dataLength, numBits, dataStream);
+    appendBits(dataStream, dataLength, getCharacterCountBits(MODE_ALPHANUMERIC, plan->version));
 
     // Write groups of 2 characters to the data stream
     for (int i = 0; i < dataLength / 2; i++) {
@@ -199,42 +202,30 @@ static void alphanumericEncoding(char* data, linkedlist* dataStream, int qrVersi
 
         unsigned int num = 45 * firstNumber + secondNumber;
 
-        convertToBitStream(num, 11, dataStream);
+        appendBits(dataStream, num, 11);
     }
 
     if (dataLength % 2 == 1) {
         unsigned int num = getAlphanumericCode(data[dataLength - 1]);
-        convertToBitStream(num, 6, dataStream);
+        appendBits(dataStream, num, 6);
     }
 }
 
-static void byteEncoding(char* data, linkedlist* dataStream, int qrVersion) {
-    unsigned char modeIndicator[] = {0, 1, 0, 0};
-
-    for (int i = 0; i < 4; i++)
-        addLinkedListNode(dataStream, modeIndicator[i]);
+static void byteEncoding(const uint8_t* data, const EncodingPlan* plan, BitStream* dataStream) {
+    // Write the 4 bit mode indicator
+    appendBits(dataStream, 0b0100, 4);
 
-    size_t dataLength = strnlen(data, MAX_QR_CHARS);
+    size_t dataLength = plan->length;
 
     assert(dataLength > 0);
-    assert(qrVersion >= 1 && qrVersion <= 40);
 
-    int numBits;
-    if (qrVersion <= 9) {
-        // 8 bit character count
-        numBits = 8;
-    } else {
-        // 16 bit character count
-        numBits = 16;
-    }
     // Write data length to the data stream
-    convertToBitStream(dataLength, numBits, dataStream);
+    appendBits(dataStream, dataLength, getCharacterCountBits(MODE_BYTE, plan->version));
 
-    for (int i = 0; i < dataLength; i++)
-        convertToBitStream(data[i], 8, dataStream);
+    appendBytes(dataStream, data, dataLength);
 }
 
-static void addTerminator(linkedlist* dataStream, int qrVersion, ErrorCorrectionLevel ecLevel) {
+static void addTerminator(BitStream* dataStream, int qrVersion, ErrorCorrectionLevel ecLevel) {
     unsigned int numRequiredBits = totalDataCodewordsLUT[qrVersion][ecLevel] * 8;
     assert(dataStream->size <= numRequiredBits);
     if (dataStream->size == numRequiredBits)
@@ -242,20 +233,18 @@ static void addTerminator(linkedlist* dataStream, int qrVersion, ErrorCorrection
 
     unsigned int numTerminatingZeros = MIN(numRequiredBits - dataStream->size, 4);
 
-    for (int i = 0; i < numTerminatingZeros; i++)
-        addLinkedListNode(dataStream, 0);
+    appendBits(dataStream, 0, numTerminatingZeros);
 }
 
-static void addMoreZeros(linkedlist* dataStream) {
+static void addMoreZeros(BitStream* dataStream) {
     if (dataStream->size % 8 == 0)
         return;
 
     unsigned int numMoreZeros = 8 - dataStream->size % 8;
-    for (int i = 0; i < numMoreZeros; i++)
-        addLinkedListNode(dataStream, 0);
+    appendBits(dataStream, 0, numMoreZeros);
 }
 
-static void addPadding(linkedlist* dataStream, int qrVersion, ErrorCorrectionLevel ecLevel) {
+static void addPadding(BitStream* dataStream, int qrVersion, ErrorCorrectionLevel ecLevel) {
     unsigned int numRequiredBits = totalDataCodewordsLUT[qrVersion][ecLevel] * 8;
     assert(dataStream->size <= numRequiredBits);
     if (dataStream->size == numRequiredBits)
@@ -267,53 +256,36 @@ static void addPadding(linkedlist* dataStream, int qrVersion, ErrorCorrectionLev
     unsigned int bytesToAdd = (numRequiredBits - dataStream->size) / 8;
     for (int i = 0; i < bytesToAdd; i++) {
         if (i % 2 == 0)
-            convertToBitStream(fillPattern1, 8, dataStream);
+            appendBits(dataStream, fillPattern1, 8);
         else
-            convertToBitStream(fillPattern2, 8, dataStream);
+            appendBits(dataStream, fillPattern2, 8);
     }
 }
 
 unsigned int getMaxQRCharacters(char* data, ErrorCorrectionLevel ecLevel) {
-    unsigned int qrVersion = calculateQRVersion(data, ecLevel);
-    EncodingMode encodingMode = calculateEncodingMode(data);
-
-    unsigned int maxCharacters = 0;
-    switch (encodingMode) {
-        case MODE_NUMERIC:
-            maxCharacters = numericCharCapacityLUT[qrVersion][ecLevel];
-            break;
-        case MODE_ALPHANUMERIC:
-            maxCharacters = alphanumericCharCapacityLUT[qrVersion][ecLevel];
-            break;
-        case MODE_BYTE:
-            maxCharacters = byteCharCapacityLUT[qrVersion][ecLevel];
-            break;
-        case MODE_KANJI:
-            assert(0);
-            break;
-        case MODE_ECI:
-            assert(0);
-            break;
-    }
-
-    return maxCharacters;
+    return planEncoding(data, ecLevel).capacity;
 }
 
-Polynomial* encodeData(char* data, unsigned int qrVersion, ErrorCorrectionLevel ecLevel) {
+void encodeDataInto(const uint8_t* data, const EncodingPlan* plan, uint8_t* codewords) {
+    unsigned int qrVersion = plan->version;
+    ErrorCorrectionLevel ecLevel = plan->ecLevel;
     assert(qrVersion >= 1 && qrVersion <= 40);
 
-    EncodingMode encodingMode = calculateEncodingMode(data);
-    linkedlist* dataStream = createLinkedList();
+    // The data stream never grows past the data capacity of the symbol, so the
+    // bits can be written straight into the caller's codeword buffer
+    BitStream stream;
+    BitStream* dataStream = &stream;
+    initBitStream(dataStream, codewords, totalDataCodewordsLUT[qrVersion][ecLevel]);
 
-    switch (encodingMode) {
+    switch (plan->mode) {
         case MODE_NUMERIC:
-            numericEncoding(data, dataStream, qrVersion);
+            numericEncoding(data, plan, dataStream);
             break;
         case MODE_ALPHANUMERIC:
-            alphanumericEncoding(data, dataStream, qrVersion);
+            alphanumericEncoding(data, plan, dataStream);
             break;
         case MODE_BYTE:
-            byteEncoding(data, dataStream, qrVersion);
+            byteEncoding(data, plan, dataStream);
             break;
         case MODE_KANJI:
             assert(0);
@@ -322,6 +294,7 @@ Polynomial* encodeData(char* data, unsigned int qrVersion, ErrorCorrectionLevel
             assert(0);
             break;
     }
+    assert(dataStream->size == plan->bitCount);
 
     addTerminator(dataStream, qrVersion, ecLevel);
     addMoreZeros(dataStream);
@@ -329,25 +302,46 @@ Polynomial* encodeData(char* data, unsigned int qrVersion, ErrorCorrectionLevel
 
     size_t dataStreamBits = dataStream->size;
 
-    assert(dataStreamBits % 8 == 0 && dataStreamBits > 0);
+    assert(dataStreamBits == totalDataCodewordsLUT[qrVersion][ecLevel] * 8);
+    (void)dataStreamBits;
+}
 
-    size_t codewordsSize = dataStreamBits / 8;
-    Polynomial* codewordsPolynomial = createPolynomial(codewordsSize);
+Polynomial* encodeData(const uint8_t* data, const EncodingPlan* plan) {
+    Polynomial* codewordsPolynomial = createPolynomial(totalDataCodewordsLUT[plan->version][plan->ecLevel]);
+    encodeDataInto(data, plan, codewordsPolynomial->data);
 
-    struct linkedlistNode* currentNode = dataStream->head;
-    for (int i = 0; i < codewordsSize; i++) {
-        for (int j = 0; j < 8; j++) {
-            unsigned char val = currentNode->data << (7 - j);
-            codewordsPolynomial->data[i] |= val;
-            currentNode = currentNode->next;
-        }
+    return codewordsPolynomial;
+};
+
+static void splitIntoBlocks(DataBlocks* blocks, const uint8_t* codewords,
+        unsigned int codewordsPerGroup1Block, unsigned int codewordsPerGroup2Block) {
+    // Point each block's view at its run of the (contiguous) codewords
+    unsigned int idx = 0;
+    for (int i = 0; i < blocks->numGroup1Blocks; i++) {
+        blocks->group1[i] = (PolynomialView){codewords + idx, codewordsPerGroup1Block};
+        idx += codewordsPerGroup1Block;
     }
 
-    freeLinkedList(dataStream);
-    dataStream = NULL;
+    for (int i = 0; i < blocks->numGroup2Blocks; i++) {
+        blocks->group2[i] = (PolynomialView){codewords + idx, codewordsPerGroup2Block};
+        idx += codewordsPerGroup2Block;
+    }
 
-    return codewordsPolynomial;
-};
+    blocks->codewordsPerGroup1Block = codewordsPerGroup1Block;
+    blocks->codewordsPerGroup2Block = codewordsPerGroup2Block;
+}
+
+static void rsEncodeBlocks(const DataBlocks* dataBlocks, DataBlocks* rsDataBlocks,
+        uint8_t* ecCodewords, const RSGenerator* generator) {
+    size_t numECCodewords = generator->polynomial.size - 1;
+    splitIntoBlocks(rsDataBlocks, ecCodewords, numECCodewords, numECCodewords);
+
+    for (int i = 0; i < dataBlocks->numGroup1Blocks; i++)
+        rsEncodeBlock(dataBlocks->group1[i], generator, (uint8_t*)rsDataBlocks->group1[i].data);
+
+    for (int i = 0; i < dataBlocks->numGroup2Blocks; i++)
+        rsEncodeBlock(dataBlocks->group2[i], generator, (uint8_t*)rsDataBlocks->group2[i].data);
+}
 
 DataBlocks* fragmentEncodedData(Polynomial* encodedData, unsigned int qrVersion,
         ErrorCorrectionLevel ecLevel) {
@@ -361,25 +355,19 @@ DataBlocks* fragmentEncodedData(Polynomial* encodedData, unsigned int qrVersion,
 
     DataBlocks* dataBlocks = (DataBlocks*)malloc(sizeof(DataBlocks));
 
-    dataBlocks->group1 = (Polynomial**)malloc(sizeof(Polynomial*) * dataBlocksInGroup1);
+    // The blocks are views into encodedData, which has to outlive them
+    dataBlocks->codewords = NULL;
+    dataBlocks->group1 = (PolynomialView*)malloc(sizeof(PolynomialView) * dataBlocksInGroup1);
     dataBlocks->numGroup1Blocks = dataBlocksInGroup1;
-    dataBlocks->codewordsPerGroup1Block = dataCodewordsPerGroup1Block;
     dataBlocks->group2 = NULL;
     if (dataBlocksInGroup2 > 0)
-        dataBlocks->group2 = (Polynomial**)malloc(sizeof(Polynomial*) * dataBlocksInGroup2);
+        dataBlocks->group2 = (PolynomialView*)malloc(sizeof(PolynomialView) * dataBlocksInGroup2);
     dataBlocks->numGroup2Blocks = dataBlocksInGroup2;
-    dataBlocks->codewordsPerGroup2Block = dataCodewordsPerGroup2Block;
 
-    unsigned int idx = 0;
-    for (int i = 0; i < dataBlocksInGroup1; i++) {
-        dataBlocks->group1[i] = slicePolynomial(encodedData, idx, idx + dataCodewordsPerGroup1Block);
-        idx += dataCodewordsPerGroup1Block;
-    }
-
-    for (int i = 0; i < dataBlocksInGroup2; i++) {
-        dataBlocks->group2[i] = slicePolynomial(encodedData, idx, idx + dataCodewordsPerGroup2Block);
-        idx += dataCodewordsPerGroup2Block;
-    }
+    assert(encodedData->size == dataBlocksInGroup1 * dataCodewordsPerGroup1Block +
+            dataBlocksInGroup2 * dataCodewordsPerGroup2Block);
+    splitIntoBlocks(dataBlocks, encodedData->data, dataCodewordsPerGroup1Block,
+            dataCodewordsPerGroup2Block);
 
     return dataBlocks;
 }
@@ -389,27 +377,25 @@ DataBlocks* rsEncodeDataBlocks(DataBlocks* dataBlocks, unsigned int qrVersion,
     unsigned int numECCodewords = ecCodewordsPerBlockLUT[qrVersion][ecLevel];
     DataBlocks* rsDataBlocks = (DataBlocks*)malloc(sizeof(DataBlocks));
     rsDataBlocks->numGroup1Blocks = dataBlocks->numGroup1Blocks;
-    rsDataBlocks->codewordsPerGroup1Block = numECCodewords;
     rsDataBlocks->numGroup2Blocks = dataBlocks->numGroup2Blocks;
-    rsDataBlocks->codewordsPerGroup2Block = numECCodewords;
-
-    rsDataBlocks->group1 = (Polynomial**)malloc(sizeof(Polynomial*) * rsDataBlocks->numGroup1Blocks);
-    rsDataBlocks->group2 = (Polynomial**)malloc(sizeof(Polynomial*) * rsDataBlocks->numGroup2Blocks);
 
-    Polynomial* generator = createGeneratorPolynomial(numECCodewords);
-    for (int i = 0; i < rsDataBlocks->numGroup1Blocks; i++)
-        rsDataBlocks->group1[i] = rsEncodePolynomial(dataBlocks->group1[i], generator);
+    rsDataBlocks->group1 = (PolynomialView*)malloc(sizeof(PolynomialView) * rsDataBlocks->numGroup1Blocks);
+    rsDataBlocks->group2 = (PolynomialView*)malloc(sizeof(PolynomialView) * rsDataBlocks->numGroup2Blocks);
 
-    for (int i = 0; i < rsDataBlocks->numGroup2Blocks; i++)
-        rsDataBlocks->group2[i] = rsEncodePolynomial(dataBlocks->group2[i], generator);
+    // All of the EC codewords share one buffer, owned by rsDataBlocks
+    unsigned int numBlocks = rsDataBlocks->numGroup1Blocks + rsDataBlocks->numGroup2Blocks;
+    rsDataBlocks->codewords = (uint8_t*)malloc(sizeof(uint8_t) * numBlocks * numECCodewords);
+    if (rsDataBlocks->codewords == NULL) {
+        perror("rsEncodeDataBlocks() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
 
-    freePolynomial(generator);
-    generator = NULL;
+    rsEncodeBlocks(dataBlocks, rsDataBlocks, rsDataBlocks->codewords, getRSGenerator(numECCodewords));
 
     return rsDataBlocks;
 }
 
-linkedlist* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsCodewordBlocks,
+BitStream* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsCodewordBlocks,
         unsigned int qrVersion, ErrorCorrectionLevel ecLevel) {
 
     const unsigned int totalDataCodewords = totalDataCodewordsLUT[qrVersion][ecLevel];
@@ -426,7 +412,7 @@ linkedlist* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsC
         // Group 1 blocks
         for (int j = 0; j < encodedDataBlocks->numGroup1Blocks; j++) {
             if (col < encodedDataBlocks->codewordsPerGroup1Block) {
-                Polynomial* currentBlock = encodedDataBlocks->group1[j];
+                const PolynomialView* currentBlock = &encodedDataBlocks->group1[j];
                 interleavedDataCodewords->data[idx] = currentBlock->data[col];
                 idx++;
             }
@@ -434,7 +420,7 @@ linkedlist* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsC
 
         for (int j = 0; j < encodedDataBlocks->numGroup2Blocks; j++) {
             if (col < encodedDataBlocks->codewordsPerGroup2Block) {
-                Polynomial* currentBlock = encodedDataBlocks->group2[j];
+                const PolynomialView* currentBlock = &encodedDataBlocks->group2[j];
                 interleavedDataCodewords->data[idx] = currentBlock->data[col];
                 idx++;
             }
@@ -449,7 +435,7 @@ linkedlist* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsC
         // Group 1 blocks
         for (int j = 0; j < rsCodewordBlocks->numGroup1Blocks; j++) {
             if (col < rsCodewordBlocks->codewordsPerGroup1Block) {
-                Polynomial* currentBlock = rsCodewordBlocks->group1[j];
+                const PolynomialView* currentBlock = &rsCodewordBlocks->group1[j];
                 interleavedECCodewords->data[idx] = currentBlock->data[col];
                 idx++;
             }
@@ -457,7 +443,7 @@ linkedlist* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsC
 
         for (int j = 0; j < rsCodewordBlocks->numGroup2Blocks; j++) {
             if (col < rsCodewordBlocks->codewordsPerGroup2Block) {
-                Polynomial* currentBlock = rsCodewordBlocks->group2[j];
+                const PolynomialView* currentBlock = &rsCodewordBlocks->group2[j];
                 interleavedECCodewords->data[idx] = currentBlock->data[col];
                 idx++;
             }
@@ -479,38 +465,29 @@ linkedlist* structureFinalMessage(DataBlocks* encodedDataBlocks, DataBlocks* rsC
     freePolynomial(interleavedECCodewords);
     interleavedECCodewords = NULL;
 
-    linkedlist* finalMessage = createLinkedList();
+    unsigned int remainderBits = finalMessageRemainderBitsLUT[qrVersion];
+
+    // Leave room for the remainder bits in one extra byte
+    BitStream* finalMessage = createBitStream(finalMessagePolynomial->size + 1);
     for (int i = 0; i < finalMessagePolynomial->size; i++)
-        convertToBitStream(finalMessagePolynomial->data[i], 8, finalMessage);
+        appendBits(finalMessage, finalMessagePolynomial->data[i], 8);
 
     freePolynomial(finalMessagePolynomial);
     finalMessagePolynomial = NULL;
 
-    unsigned int remainderBits = finalMessageRemainderBitsLUT[qrVersion];
-
-    for (int i = 0; i < remainderBits; i++) {
-        addLinkedListNode(finalMessage, 0);
-    }
+    appendBits(finalMessage, 0, remainderBits);
 
     return finalMessage;
 }
 
 void freeDataBlocks(DataBlocks* dataBlocks) {
-    // Free the polynomial slices in group 1
-    for (int i = 0; i < dataBlocks->numGroup1Blocks; i++) {
-        freePolynomial(dataBlocks->group1[i]);
-        dataBlocks->group1[i] = NULL;
-    }
+    // The views don't own their codewords, only the shared buffer (if any) is freed
     free(dataBlocks->group1);
     dataBlocks->group1 = NULL;
-
-    // Free the polynomial slices in group 2
-    for (int i = 0; i < dataBlocks->numGroup2Blocks; i++) {
-        freePolynomial(dataBlocks->group2[i]);
-        dataBlocks->group2[i] = NULL;
-    }
     free(dataBlocks->group2);
     dataBlocks->group2 = NULL;
+    free(dataBlocks->codewords);
+    dataBlocks->codewords = NULL;
 
     free(dataBlocks);
 }
@@ -519,52 +496,169 @@ QR* initQR(unsigned int qrVersion) {
     assert(qrVersion > 0);
     assert(qrVersion < 41);
 
-    QR* qr = (QR*)malloc(sizeof(QR));
-    qr->version = qrVersion;
-    qr->width = 4 * qrVersion + 17;
-    qr->data = (unsigned int**)malloc(sizeof(unsigned int*) * qr->width);
-    if (qr->data == NULL) {
+    unsigned int width = 4 * qrVersion + 17;
+
+    // The modules are stored row by row directly after the struct, so the whole
+    // matrix comes from a single allocation
+    QR* qr = (QR*)malloc(sizeof(QR) + sizeof(uint8_t) * width * width);
+    if (qr == NULL) {
         perror("intiQR() - failed to malloc");
         exit(EXIT_FAILURE);
     }
 
-    for (int i = 0; i < qr->width; i++) {
-        qr->data[i] = (unsigned int*)malloc(sizeof(unsigned int) * qr->width);
-        if (qr->data[i] == NULL) {
-            perror("intiQR() - failed to malloc");
-            exit(EXIT_FAILURE);
-        }
+    qr->version = qrVersion;
+    qr->width = width;
+    qr->data = (uint8_t*)(qr + 1);
 
-        for (int j = 0; j < qr->width; j++) {
-            // init to an arbitrary value (0xFF) to represent an unset module
-            qr->data[i][j] = UNSET_MODULE;  
-        }
-    }
+    // init to an arbitrary value (0x7F) to represent an unset module
+    memset(qr->data, UNSET_MODULE, sizeof(uint8_t) * width * width);
 
     return qr;
 }
 
-QR* copyQR(QR* qr) {
+QR* copyQR(const QR* qr) {
     QR* newQR = initQR(qr->version);
-    for (int i = 0; i < qr->width; i++) {
-        for (int j = 0; j < qr->width; j++) {
-            newQR->data[i][j] = qr->data[i][j];
-        }
-    }
+    memcpy(newQR->data, qr->data, sizeof(uint8_t) * qr->width * qr->width);
 
     return newQR;
 }
 
 void freeQR(QR* qr) {
-    for (int i = 0; i < qr->width; i++) {
-        free(qr->data[i]);
-        qr->data[i] = NULL;
+    // The module buffer is part of the same allocation as the struct
+    qr->data = NULL;
+    free(qr);
+}
+
+static size_t findDataModules(const QR* blankQR, uint16_t* offsets) {
+    // Walk the data region in the zigzag placement order: two-module wide
+    // columns from right to left, alternating between upwards and downwards,
+    // skipping the vertical timing pattern and any function modules
+    int width = (int)blankQR->width;
+    size_t numDataModules = 0;
+    bool upwards = true;
+
+    for (int right = width - 1; right >= 1; right -= 2) {
+        if (right == 6)
+            right--;
+
+        for (int k = 0; k < width; k++) {
+            int row = upwards ? width - 1 - k : k;
+            for (int col = right; col >= right - 1; col--) {
+                if (!isFunctionModule(blankQR, row, col))
+                    offsets[numDataModules++] = row * width + col;
+            }
+        }
+
+        upwards = !upwards;
     }
 
-    free(qr->data);
-    qr->data = NULL;
+    return numDataModules;
+}
 
-    free(qr);
+static uint16_t* findCodewordPositions(unsigned int qrVersion, ErrorCorrectionLevel ecLevel) {
+    const unsigned int numGroup1Blocks = dataBlocksInGroup1LUT[qrVersion][ecLevel];
+    const unsigned int numBlocks = numGroup1Blocks + dataBlocksInGroup2LUT[qrVersion][ecLevel];
+    const unsigned int group1BlockSize = dataCodewordsPerGroup1BlockLUT[qrVersion][ecLevel];
+    const unsigned int group2BlockSize = dataCodewordsPerGroup2BlockLUT[qrVersion][ecLevel];
+    const unsigned int numECCodewords = ecCodewordsPerBlockLUT[qrVersion][ecLevel];
+    const unsigned int totalDataCodewords = totalDataCodewordsLUT[qrVersion][ecLevel];
+    const unsigned int totalCodewords = totalDataCodewords + numECCodewords * numBlocks;
+
+    uint16_t* positions = (uint16_t*)malloc(sizeof(uint16_t) * totalCodewords);
+    if (positions == NULL) {
+        perror("findCodewordPositions() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // Data codewords are interleaved column by column across the blocks. Group 2
+    // blocks are one codeword longer, so the last column only has group 2 blocks.
+    unsigned int idx = 0;
+    for (unsigned int col = 0; col < MAX(group1BlockSize, group2BlockSize); col++) {
+        for (unsigned int j = 0; j < numBlocks; j++) {
+            unsigned int blockStart = j < numGroup1Blocks ? j * group1BlockSize :
+                numGroup1Blocks * group1BlockSize + (j - numGroup1Blocks) * group2BlockSize;
+            unsigned int blockSize = j < numGroup1Blocks ? group1BlockSize : group2BlockSize;
+            if (col < blockSize)
+                positions[blockStart + col] = idx++;
+        }
+    }
+    assert(idx == totalDataCodewords);
+
+    // Every block has the same number of error correction codewords
+    for (unsigned int col = 0; col < numECCodewords; col++)
+        for (unsigned int j = 0; j < numBlocks; j++)
+            positions[totalDataCodewords + j * numECCodewords + col] = idx++;
+
+    return positions;
+}
+
+static QRTemplate* createQRTemplate(unsigned int qrVersion) {
+    QRTemplate* qrTemplate = (QRTemplate*)malloc(sizeof(QRTemplate));
+    if (qrTemplate == NULL) {
+        perror("createQRTemplate() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    QR* qr = initQR(qrVersion);
+
+    addFinderPatterns(qr);
+    addSeparators(qr);
+    addAlignmentPatterns(qr);
+    addTimingPatterns(qr);
+    addDarkModule(qr);
+    reserveFormatInfo(qr);
+    reserveVersionInfo(qr);
+
+    // Every module that isn't part of a function pattern holds data, so the
+    // table can't be larger than the matrix itself
+    uint16_t* offsets = (uint16_t*)malloc(sizeof(uint16_t) * qr->width * qr->width);
+    if (offsets == NULL) {
+        perror("createQRTemplate() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t numDataModules = findDataModules(qr, offsets);
+
+    unsigned int numBlocks = dataBlocksInGroup1LUT[qrVersion][EC_L] + dataBlocksInGroup2LUT[qrVersion][EC_L];
+    unsigned int totalCodewords = totalDataCodewordsLUT[qrVersion][EC_L] +
+        ecCodewordsPerBlockLUT[qrVersion][EC_L] * numBlocks;
+    assert(numDataModules == totalCodewords * 8 + finalMessageRemainderBitsLUT[qrVersion]);
+    (void)totalCodewords;
+
+    qrTemplate->blank = qr;
+    qrTemplate->maskPlanes = createQRMaskPlanes(qr);
+    qrTemplate->functionPlane = createFunctionPlane(qr);
+    qrTemplate->reservedPlane = createReservedPlane(qr);
+    qrTemplate->dataModuleOffsets = realloc(offsets, sizeof(uint16_t) * numDataModules);
+    qrTemplate->numDataModules = numDataModules;
+
+    for (int ecLevel = EC_L; ecLevel <= EC_H; ecLevel++)
+        qrTemplate->codewordPositions[ecLevel] = findCodewordPositions(qrVersion, ecLevel);
+
+    return qrTemplate;
+}
+
+// The function patterns only depend on the version, so each template is built
+// the first time it is needed and then shared by every symbol of that version
+static QRTemplate* qrTemplates[41] = {NULL};
+static pthread_mutex_t qrTemplatesLock = PTHREAD_MUTEX_INITIALIZER;
+
+const QRTemplate* getQRTemplate(unsigned int qrVersion) {
+    assert(qrVersion > 0);
+    assert(qrVersion < 41);
+
+    QRTemplate* qrTemplate = __atomic_load_n(&qrTemplates[qrVersion], __ATOMIC_ACQUIRE);
+    if (qrTemplate != NULL)
+        return qrTemplate;
+
+    pthread_mutex_lock(&qrTemplatesLock);
+    qrTemplate = qrTemplates[qrVersion];
+    if (qrTemplate == NULL) {
+        qrTemplate = createQRTemplate(qrVersion);
+        __atomic_store_n(&qrTemplates[qrVersion], qrTemplate, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&qrTemplatesLock);
+
+    return qrTemplate;
 }
 
 void addFinderPatterns(QR* qr) {
@@ -572,13 +666,13 @@ void addFinderPatterns(QR* qr) {
     for (int i = 0; i < 7; i++) {
         for (int j = 0; j < 7; j++) {
             if (i % 6 == 0 || j % 6 == 0 || (j > 1 && j < 5 && i > 1 && i < 5)) {
-                qr->data[i][j] = 1;              //top left
-                qr->data[i][width - 7 + j] = 1;   //top right
-                qr->data[width - 7 + i][j] = 1;   //bottom left
+                setFunctionModule(qr, i, j, 1);             //top left
+                setFunctionModule(qr, i, width - 7 + j, 1);  //top right
+                setFunctionModule(qr, width - 7 + i, j, 1);  //bottom left
             } else {
-                qr->data[i][j] = 0;              //top left
-                qr->data[i][width - 7 + j] = 0;   //top right
-                qr->data[width - 7 + i][j] = 0;   //bottom left
+                setFunctionModule(qr, i, j, 0);             //top left
+                setFunctionModule(qr, i, width - 7 + j, 0);  //top right
+                setFunctionModule(qr, width - 7 + i, j, 0);  //bottom left
             }
         }
     }
@@ -587,12 +681,12 @@ void addFinderPatterns(QR* qr) {
 void addSeparators(QR* qr) {
     unsigned int width = qr->width;
     for (int i = 0; i < 8; i++) {
-        qr->data[7][i] = 0;                 //top left
-        qr->data[i][7] = 0;
-        qr->data[7][width - 8 + i] = 0;     //top right
-        qr->data[i][width - 8] = 0;         //top right
-        qr->data[width - 8][i] = 0;         //bottom left
-        qr->data[width - 8 + i][7] = 0;
+        setFunctionModule(qr, 7, i, 0);                 //top left
+        setFunctionModule(qr, i, 7, 0);
+        setFunctionModule(qr, 7, width - 8 + i, 0);     //top right
+        setFunctionModule(qr, i, width - 8, 0);         //top right
+        setFunctionModule(qr, width - 8, i, 0);         //bottom left
+        setFunctionModule(qr, width - 8 + i, 7, 0);
     }
 }
 
@@ -606,15 +700,15 @@ static void placeAlignmentPattern(QR* qr, unsigned int row, unsigned int col) {
     // Check for populated cells
     for (int i = 0; i < 5; i++)
         for (int j = 0; j < 5; j++)
-            if (qr->data[row - 2 + i][col - 2 + j] != UNSET_MODULE)
+            if (getModule(qr, row - 2 + i, col - 2 + j) != UNSET_MODULE)
                 return;
 
     for (int i = 0; i < 5; i++) {
         for (int j = 0; j < 5; j++) {
             if (i % 4 == 0 || j % 4 ==0 || (i == 2 && j == 2))
-                qr->data[row - 2 + i][col - 2 + j] = 1;
+                setFunctionModule(qr, row - 2 + i, col - 2 + j, 1);
             else
-                qr->data[row - 2 + i][col - 2 + j] = 0;
+                setFunctionModule(qr, row - 2 + i, col - 2 + j, 0);
         }
     }
 }
@@ -640,24 +734,24 @@ void addAlignmentPatterns(QR* qr) {
 void addTimingPatterns(QR* qr) {
     int numTimingModules = qr->width - 16;
     for (int i = 0; i < numTimingModules; i++) {
-        if (qr->data[6][8 + i] != UNSET_MODULE)
+        if (getModule(qr, 6, 8 + i) != UNSET_MODULE)
             continue;
         else if (i % 2 == 0)
-            qr->data[6][8 + i] = 1;
+            setFunctionModule(qr, 6, 8 + i, 1);
         else
-            qr->data[6][8 + i] = 0;
+            setFunctionModule(qr, 6, 8 + i, 0);
 
-        if (qr->data[8 + i][6] != UNSET_MODULE)
+        if (getModule(qr, 8 + i, 6) != UNSET_MODULE)
             continue;
         else if (i % 2 == 0)
-            qr->data[8 + i][6] = 1;
+            setFunctionModule(qr, 8 + i, 6, 1);
         else
-            qr->data[8 + i][6] = 0;
+            setFunctionModule(qr, 8 + i, 6, 0);
     }
 }
 
 void addDarkModule(QR* qr) {
-    qr->data[4 * qr->version + 9][8] = 1;
+    setFunctionModule(qr, 4 * qr->version + 9, 8, 1);
 }
 
 void reserveFormatInfo(QR* qr) {
@@ -666,18 +760,18 @@ void reserveFormatInfo(QR* qr) {
     for (int i = 0; i < 9; i++) {
         if (i == 6)
             continue;
-        qr->data[8][i] = 2;
-        qr->data[i][8] = 2;
+        setFunctionModule(qr, 8, i, 2);
+        setFunctionModule(qr, i, 8, 2);
     }
 
     // Top right format info
     for (int i = 0; i < 8; i++) {
-        qr->data[8][width - 8 + i] = 2;
+        setFunctionModule(qr, 8, width - 8 + i, 2);
     }
 
     // Bottom left format info
     for (int i = 0; i < 7; i++) {
-        qr->data[width - 7 + i][8] = 2;
+        setFunctionModule(qr, width - 7 + i, 8, 2);
     }
 }
 
@@ -688,13 +782,40 @@ void reserveVersionInfo(QR* qr) {
     unsigned int width = qr->width;
     for (int i = 0; i < 3; i++) {
         for (int j = 0; j < 6; j++) {
-            qr->data[width - 11 + i][j] = 3;
-            qr->data[j][width - 11 + i] = 3;
+            setFunctionModule(qr, width - 11 + i, j, 3);
+            setFunctionModule(qr, j, width - 11 + i, 3);
         }
     }
 }
 
-QR* createMask(QR* qr, unsigned int maskType) {
+bool maskCondition(unsigned int maskType, unsigned int row, unsigned int col) {
+    unsigned int i = row;
+    unsigned int j = col;
+    switch (maskType) {
+        case 0:
+            return (i + j) % 2 == 0;
+        case 1:
+            return i % 2 == 0;
+        case 2:
+            return j % 3 == 0;
+        case 3:
+            return (i + j) % 3 == 0;
+        case 4:
+            return (i/2 + j/3) % 2 == 0;
+        case 5:
+            return (i * j) % 2 + (i * j) % 3 == 0;
+        case 6:
+            return ((i * j) % 2 + (i * j) % 3) % 2 == 0;
+        case 7:
+            return ((i + j) % 2 + (i * j) % 3) % 2 == 0;
+        default:
+            assert(0);
+    }
+
+    return false;
+}
+
+QR* createMask(const QR* qr, unsigned int maskType) {
     assert(maskType >= 0);
     assert(maskType <= 7);
 
@@ -703,151 +824,94 @@ QR* createMask(QR* qr, unsigned int maskType) {
     unsigned int width = qr->width;
     for (int i = 0; i < width; i++) {
         for (int j = 0; j < width; j++) {
-            if (qr->data[i][j] != UNSET_MODULE) {
-                maskPattern->data[i][j] = 0;
-                continue;
-            }
-            switch (maskType) {
-                case 0:
-                    if ((i + j) % 2 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-                case 1:
-                    if (i % 2 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-                case 2:
-                    if (j % 3 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-                case 3:
-                    if ((i + j) % 3 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-                case 4:
-                    if ((i/2 + j/3) % 2 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-                case 5:
-                    if ((i * j) % 2 + (i * j) % 3 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-                case 6:
-                    if (((i * j) % 2 + (i * j) % 3) % 2 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-                case 7:
-                    if (((i + j) % 2 + (i * j) % 3) % 2 == 0) {
-                        maskPattern->data[i][j] = 1;
-                    } else {
-                        maskPattern->data[i][j] = 0;
-                    }
-                    break;
-            }
+            if (isFunctionModule(qr, i, j))
+                setModule(maskPattern, i, j, 0);
+            else
+                setModule(maskPattern, i, j, maskCondition(maskType, i, j));
         }
     }
 
     return maskPattern;
 }
 
-void placeDataBits(QR* qr, linkedlist* data) {
-    typedef enum {
-        UP,
-        DOWN
-    } Direction;
-
-    // Start in the bottom right-hand corner of the QR code
-    // Place bits starting in the UP direction
-    int xPos = (int)qr->width - 1;
-    int yPos = (int)qr->width - 1;
-    Direction dir = UP;
-
-    unsigned int counter = 0;   // Used to help fill in the modules in a zigzag pattern
-
-    unsigned int placedBits = 0;
-    struct linkedlistNode* currentNode = data->head;
-
-    // Place each data bit into the QR code
-    while (placedBits < data->size) {
-        // Check if we are at an edge and need to switch directions
-        if (yPos >= (int)qr->width) {
-            xPos -= 2;
-            if (xPos == 6)
-                xPos--;
-            yPos--;
-            dir = UP;
-            counter = 0;
-        } else if (yPos < 0) {
-            xPos -= 2;
-            if (xPos == 6)
-                xPos--;
-            yPos++;
-            dir = DOWN;
-            counter = 0;
-        }
+void placeDataBits(QR* qr, BitStream* data) {
+    // The template lists every data module in zigzag order, so placing the
+    // bits is a straight scatter with no checks for function patterns
+    const QRTemplate* qrTemplate = getQRTemplate(qr->version);
+    const uint16_t* offsets = qrTemplate->dataModuleOffsets;
+    assert(data->size - data->cursor <= qrTemplate->numDataModules);
 
-        // Only place a bit if the module is unset (0xFF)
-        // So we don't overwrite finder patterns, etc.
-        if (qr->data[yPos][xPos] == UNSET_MODULE) {
-            qr->data[yPos][xPos] = currentNode->data;
-            currentNode = currentNode->next;
-            placedBits++;
-        }
+    for (size_t i = 0; data->cursor < data->size; i++)
+        qr->data[offsets[i]] = readBit(data);
+}
 
-        switch (dir) {
-            case UP:
-                if (counter == 0) {
-                    xPos--;
-                } else if (counter == 1) {
-                    xPos++;
-                    yPos--;
-                }
-                break;
-            case DOWN:
-                if (counter == 0) {
-                    xPos--;
-                } else if (counter == 1) {
-                    xPos++;
-                    yPos++;
-                }
-                break;
-        }
+static inline void placeCodeword(QR* qr, const uint16_t* moduleOffsets, uint8_t codeword) {
+    for (int i = 0; i < 8; i++)
+        qr->data[moduleOffsets[i]] = (codeword >> (7 - i)) & 1;
+}
+
+static void placeBlockCodewords(QR* qr, const uint16_t* positions, unsigned int* codewordIdx,
+        const PolynomialView* blocks, unsigned int numBlocks) {
+    const uint16_t* offsets = getQRTemplate(qr->version)->dataModuleOffsets;
 
-        counter = (counter + 1) % 2;
+    for (int i = 0; i < numBlocks; i++) {
+        const PolynomialView* block = &blocks[i];
+        for (int j = 0; j < block->size; j++) {
+            unsigned int finalPosition = positions[(*codewordIdx)++];
+            placeCodeword(qr, &offsets[finalPosition * 8], block->data[j]);
+        }
     }
 }
 
+void placeDataBlocks(QR* qr, DataBlocks* dataBlocks, DataBlocks* rsDataBlocks,
+        ErrorCorrectionLevel ecLevel) {
+    // Scatter each block straight to its modules instead of interleaving the
+    // codewords into a final message first. The position table gives each
+    // codeword's index in the interleaved message, and the data module table
+    // gives the modules that index's 8 bits land on.
+    const QRTemplate* qrTemplate = getQRTemplate(qr->version);
+    const uint16_t* positions = qrTemplate->codewordPositions[ecLevel];
+
+    unsigned int codewordIdx = 0;
+    placeBlockCodewords(qr, positions, &codewordIdx, dataBlocks->group1, dataBlocks->numGroup1Blocks);
+    placeBlockCodewords(qr, positions, &codewordIdx, dataBlocks->group2, dataBlocks->numGroup2Blocks);
+    placeBlockCodewords(qr, positions, &codewordIdx, rsDataBlocks->group1, rsDataBlocks->numGroup1Blocks);
+    placeBlockCodewords(qr, positions, &codewordIdx, rsDataBlocks->group2, rsDataBlocks->numGroup2Blocks);
+
+    // Remainder bits are always 0
+    for (size_t i = codewordIdx * 8; i < qrTemplate->numDataModules; i++)
+        qr->data[qrTemplate->dataModuleOffsets[i]] = 0;
+}
+
+static void placeInterleavedCodewords(QR* qr, DataBlocks* dataBlocks, const uint8_t* ecCodewords,
+        size_t numECCodewords, ErrorCorrectionLevel ecLevel) {
+    // Like placeDataBlocks(), but the EC codewords from rsEncodeInterleaved()
+    // are already in final message order, right after the data codewords
+    const QRTemplate* qrTemplate = getQRTemplate(qr->version);
+    const uint16_t* positions = qrTemplate->codewordPositions[ecLevel];
+    const uint16_t* offsets = qrTemplate->dataModuleOffsets;
+
+    unsigned int codewordIdx = 0;
+    placeBlockCodewords(qr, positions, &codewordIdx, dataBlocks->group1, dataBlocks->numGroup1Blocks);
+    placeBlockCodewords(qr, positions, &codewordIdx, dataBlocks->group2, dataBlocks->numGroup2Blocks);
+
+    for (size_t i = 0; i < numECCodewords; i++, codewordIdx++)
+        placeCodeword(qr, &offsets[codewordIdx * 8], ecCodewords[i]);
+
+    // Remainder bits are always 0
+    for (size_t i = codewordIdx * 8; i < qrTemplate->numDataModules; i++)
+        qr->data[offsets[i]] = 0;
+}
+
 QR* applyMask(QR* qr, QR* mask) {
     assert(qr->version == mask->version);
 
     QR* maskedQR = initQR(qr->version);
 
-    for (int i = 0; i < qr->width; i++) {
-        for (int j = 0; j < qr->width; j++) {
-            maskedQR->data[i][j] = qr->data[i][j] ^ mask->data[i][j];
-        }
-    }
+    // The mask never sets the function flag, so function modules keep theirs
+    size_t numModules = qr->width * qr->width;
+    for (size_t i = 0; i < numModules; i++)
+        maskedQR->data[i] = qr->data[i] ^ mask->data[i];
 
     return maskedQR;
 }
@@ -864,22 +928,22 @@ void addFormatInformation(QR* qr, ErrorCorrectionLevel ecLevel, unsigned int mas
     // Place format info copy #1 around top left finder pattern
     for (int i = 0; i < 15; i++) {
         if (i < 6)
-            qr->data[8][i] = formatInfoString[i];
+            setFunctionModule(qr, 8, i, formatInfoString[i]);
         else if (i < 8)
-            qr->data[8][i + 1] = formatInfoString[i];
+            setFunctionModule(qr, 8, i + 1, formatInfoString[i]);
         else if (i == 8)
-            qr->data[7][8] = formatInfoString[i];
+            setFunctionModule(qr, 7, 8, formatInfoString[i]);
         else
-            qr->data[14 - i][8] = formatInfoString[i];
+            setFunctionModule(qr, 14 - i, 8, formatInfoString[i]);
     }
 
     // Place format info copy #2 next to bottom left and top right finder patterns
     for (int i = 0; i < 15; i++) {
         if (i < 7)
-            qr->data[qr->width - i - 1][8] = formatInfoString[i];
+            setFunctionModule(qr, qr->width - i - 1, 8, formatInfoString[i]);
         else
-            // qr->data[8][qr->width - 15 + i] = 3;
-            qr->data[8][qr->width - 15 + i] = formatInfoString[i];
+            // setFunctionModule(qr, 8, qr->width - 15 + i, 3);
+            setFunctionModule(qr, 8, qr->width - 15 + i, formatInfoString[i]);
     }
 }
 
@@ -899,20 +963,20 @@ void addVersionInformation(QR* qr) {
     // Place version info copy #1 next to the bottom left finder pattern
     for (int i = 0; i < 3; i++) {
         for (int j = 0; j < 6; j++) {
-            qr->data[qr->width - 11 + i][j] = versionInfoString[j * 3 + i];
+            setFunctionModule(qr, qr->width - 11 + i, j, versionInfoString[j * 3 + i]);
         }
     }
 
     // Place version info copy #2 next to the top right finder pattern
     for (int i = 0; i < 6; i++) {
         for (int j = 0; j < 3; j++) {
-            // qr->data[i][qr->width - 11 + j] = 2;
-            qr->data[i][qr->width - 11 + j] = versionInfoString[i * 3 + j];
+            // setFunctionModule(qr, i, qr->width - 11 + j, 2);
+            setFunctionModule(qr, i, qr->width - 11 + j, versionInfoString[i * 3 + j]);
         }
     }
 }
 
-static unsigned int scoreCondition1(QR* qr) {
+unsigned int scoreCondition1(QR* qr) {
     /* Condition 1:
      * Check rows and columns for consecutive and same-colored modules
      * If there are five consecutive modules of the same color, add 3 to the penalty
@@ -927,8 +991,8 @@ static unsigned int scoreCondition1(QR* qr) {
     unsigned int vertConsecutiveCount = 1;
     for (int i = 0; i < qr->width; i++) {
         for (int j = 0; j < qr->width; j++) {
-            unsigned int horizCurColor = qr->data[i][j];
-            unsigned int vertCurColor = qr->data[j][i];
+            unsigned int horizCurColor = getModule(qr, i, j);
+            unsigned int vertCurColor = getModule(qr, j, i);
             if (horizCurColor != horizPrevColor) {
                 horizPrevColor = horizCurColor;
                 horizConsecutiveCount = 1;
@@ -963,7 +1027,7 @@ static unsigned int scoreCondition1(QR* qr) {
     return score;
 }
 
-static unsigned int scoreCondition2(QR* qr) {
+unsigned int scoreCondition2(QR* qr) {
     /* Condition 2:
      * Looks for areas of the same color that are at least 2x2 modules or larger
      * Add 3 to the penalty score for every 2x2 block of the same color
@@ -974,10 +1038,10 @@ static unsigned int scoreCondition2(QR* qr) {
     for (int i = 0; i < qr->width - 1; i++) {
         for (int j = 0; j < qr->width - 1; j++) {
             // Check for 2x2 block
-            unsigned int module1 = qr->data[i][j];
-            unsigned int module2 = qr->data[i+1][j];
-            unsigned int module3 = qr->data[i][j+1];
-            unsigned int module4 = qr->data[i+1][j+1];
+            unsigned int module1 = getModule(qr, i, j);
+            unsigned int module2 = getModule(qr, i+1, j);
+            unsigned int module3 = getModule(qr, i, j+1);
+            unsigned int module4 = getModule(qr, i+1, j+1);
             if ((module1 == module2) && (module1 == module3) && (module1 == module4))
                 score += 3;
         }
@@ -986,7 +1050,7 @@ static unsigned int scoreCondition2(QR* qr) {
     return score;
 }
 
-static unsigned int scoreCondition3(QR* qr) {
+unsigned int scoreCondition3(QR* qr) {
     /* Condition 3:
      * Check for patterns that look similar to the finder patterns
      * Any time the pattern 10111010000 or 00001011101 is found, add 40 to the penalty score
@@ -1003,7 +1067,7 @@ static unsigned int scoreCondition3(QR* qr) {
             bool pattern1Match = true;
             bool pattern2Match = true;
             for (int k = 0; k < 11; k++) {
-                unsigned int curRowModule = qr->data[i][j+k];
+                unsigned int curRowModule = getModule(qr, i, j+k);
                 if (curRowModule != pattern1[k]) {
                     pattern1Match = false;
                 }
@@ -1020,7 +1084,7 @@ static unsigned int scoreCondition3(QR* qr) {
             pattern1Match = true;
             pattern2Match = true;
             for (int k = 0; k < 11; k++) {
-                unsigned int curColModule = qr->data[j+k][i];
+                unsigned int curColModule = getModule(qr, j+k, i);
                 if (curColModule != pattern1[k]) {
                     pattern1Match = false;
                 }
@@ -1038,33 +1102,33 @@ static unsigned int scoreCondition3(QR* qr) {
     return score;
 }
 
-static unsigned int scoreCondition4(QR* qr) {
+unsigned int scoreDarkModuleRatio(unsigned int numDarkModules, unsigned int totalModules) {
+    double ratio = (double) numDarkModules / (double) totalModules * 100;
+    int nextMultipleOf5 = ceil(ratio / 5.0) * 5;
+    int prevMultipleOf5 = floor(ratio / 5.0) * 5;
+
+    int diff1 = abs(50 - nextMultipleOf5);
+    int diff2 = abs(50 - prevMultipleOf5);
+
+    return MIN(diff1 / 5, diff2 / 5) * 10;
+}
+
+unsigned int scoreCondition4(QR* qr) {
     /* Condition 4:
      * Applies a penalty based on the ratio of light to dark modules
      * More penalty is applied the greater the difference in number between light and dark is
      */
-    unsigned int score = 0;
-    
     int totalModules = qr->width * qr->width;
 
     int numDarkModules = 0;
     for (int i = 0; i < qr->width; i++) {
         for (int j = 0; j < qr->width; j++) {
-            if (qr->data[i][j] == 1)
+            if (getModule(qr, i, j) == 1)
                 numDarkModules++;
         }
     }
 
-    double ratio = (double) numDarkModules / (double) totalModules * 100;
-    int nextMultipleOf5 = ceil(ratio / 5.0) * 5;
-    int prevMultipleOf5 = floor(ratio / 5.0) * 5;
-
-    int diff1 = abs(50 - nextMultipleOf5);
-    int diff2 = abs(50 - prevMultipleOf5);
-
-    score = MIN(diff1 / 5, diff2 / 5) * 10;
-
-    return score;
+    return scoreDarkModuleRatio(numDarkModules, totalModules);
 }
 
 unsigned int scoreQR(QR* qr) {
@@ -1078,7 +1142,7 @@ unsigned int scoreQR(QR* qr) {
     return score;
 }
 
-unsigned int calculateBestMask(QR* qr, QR* blankQR) {
+unsigned int calculateBestMask(QR* qr, const QR* blankQR) {
     unsigned int bestMaskID = 0;
     unsigned int bestScore = UINT_MAX;
 
@@ -1102,25 +1166,337 @@ unsigned int calculateBestMask(QR* qr, QR* blankQR) {
     return bestMaskID;
 }
 
-QR* createQRCode(char* data, ErrorCorrectionLevel ecLevel) {
-    unsigned int qrVersion = calculateQRVersion(data, ecLevel);
-    Polynomial* encodedData = encodeData(data, qrVersion, ecLevel);
+static unsigned int searchMasks(QRWorkspace* ws, QRScoringPlanes* planes, unsigned int qrVersion) {
+    // Under the auto policy, the same choice as calculateBestMask(), scored
+    // on bitplanes with a branch and bound search, see
+    // findBestMaskScoringPlanes()
+    const QRMaskPlanes* masks = getQRTemplate(qrVersion)->maskPlanes;
+    if (ws->maskPolicy == QR_MASK_FAST)
+        return findFastMaskScoringPlanes(planes, masks, &ws->maskSearchStats);
 
-    DataBlocks* dataBlocks = fragmentEncodedData(encodedData, qrVersion, ecLevel);
-    freePolynomial(encodedData);
-    encodedData = NULL;
+    unsigned int numThreads = qrVersion >= ws->parallelMaskMinVersion ? ws->maskThreads : 1;
+    return findBestMaskScoringPlanes(planes, masks, numThreads, &ws->maskSearchStats);
+}
+
+static unsigned int findBestMask(QRWorkspace* ws, const QR* qr) {
+    if (ws->maskPolicy == QR_MASK_FIXED)
+        return ws->fixedMask;
+
+    QRScoringPlanes planes;
+    packQRScoringPlanes(&planes, qr);
+    return searchMasks(ws, &planes, qr->version);
+}
+
+static unsigned int findBestMaskBitboard(QRWorkspace* ws, const QRBitboard* bb) {
+    // bb still has the format and version modules reserved
+    if (ws->maskPolicy == QR_MASK_FIXED)
+        return ws->fixedMask;
+
+    QRScoringPlanes planes;
+    packQRScoringPlanesBitboard(&planes, bb, getQRTemplate(bb->version)->reservedPlane);
+    return searchMasks(ws, &planes, bb->version);
+}
+
+QRWorkspace* createQRWorkspace(void) {
+    QRWorkspace* ws = (QRWorkspace*)malloc(sizeof(QRWorkspace));
+    if (ws == NULL) {
+        perror("createQRWorkspace() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    ws->qr.data = ws->modules;
+    ws->placed.data = ws->placedModules;
+    ws->bitboard.modules = ws->bitboardModules;
+    ws->hasSymbol = false;
+    memset(&ws->maskSearchStats, 0, sizeof(ws->maskSearchStats));
+    ws->maskPolicy = QR_MASK_AUTO;
+    ws->fixedMask = 0;
+    ws->maskThreads = 1;
+    ws->parallelMaskMinVersion = DEFAULT_PARALLEL_MASK_MIN_VERSION;
 
-    DataBlocks* rsDataBlocks = rsEncodeDataBlocks(dataBlocks, qrVersion, ecLevel);
+    ws->dataBlocks.group1 = ws->dataBlockViews;
+    ws->dataBlocks.codewords = NULL;
 
-    linkedlist* finalMessage = structureFinalMessage(dataBlocks, rsDataBlocks, qrVersion, ecLevel);
+    return ws;
+}
+
+void freeQRWorkspace(QRWorkspace* ws) {
+    free(ws);
+}
+
+static QR* finishQRCode(QRWorkspace* ws) {
+    // Picks the mask for the placed codewords and writes the final symbol to ws->qr
+    const QR* placed = &ws->placed;
+    const QRMaskPlanes* masks = getQRTemplate(placed->version)->maskPlanes;
+    QR* qr = &ws->qr;
+    qr->version = placed->version;
+    qr->width = placed->width;
+
+    unsigned int bestMaskID = findBestMask(ws, placed);
+    applyMaskPlanes(qr, placed, masks, bestMaskID);
+
+    addFormatInformation(qr, ws->plan.ecLevel, bestMaskID);
+    addVersionInformation(qr);
+
+    return qr;
+}
+
+static void placeQRCode(QRWorkspace* ws, const uint8_t* data, const EncodingPlan* plan) {
+    // Encodes data and places its codewords in ws->placed, ready for masking
+    unsigned int qrVersion = plan->version;
+    ErrorCorrectionLevel ecLevel = plan->ecLevel;
+    encodeDataInto(data, plan, ws->dataCodewords);
+
+    // Split the data into blocks, group 2 views follow the group 1 views
+    unsigned int numGroup1Blocks = dataBlocksInGroup1LUT[qrVersion][ecLevel];
+    unsigned int numGroup2Blocks = dataBlocksInGroup2LUT[qrVersion][ecLevel];
+    DataBlocks* dataBlocks = &ws->dataBlocks;
+    dataBlocks->numGroup1Blocks = numGroup1Blocks;
+    dataBlocks->numGroup2Blocks = numGroup2Blocks;
+    dataBlocks->group2 = ws->dataBlockViews + numGroup1Blocks;
+    splitIntoBlocks(dataBlocks, ws->dataCodewords, dataCodewordsPerGroup1BlockLUT[qrVersion][ecLevel],
+            dataCodewordsPerGroup2BlockLUT[qrVersion][ecLevel]);
+
+    // The EC codewords come out already interleaved
+    unsigned int numBlocks = numGroup1Blocks + numGroup2Blocks;
+    unsigned int numECCodewords = ecCodewordsPerBlockLUT[qrVersion][ecLevel];
+    rsEncodeInterleaved(ws->dataBlockViews, numBlocks, getRSGenerator(numECCodewords), ws->ecCodewords);
+
+    // The shared template doubles as the blank QR code used for masking
+    const QR* blankQR = getQRTemplate(qrVersion)->blank;
+    QR* placed = &ws->placed;
+    placed->version = qrVersion;
+    placed->width = blankQR->width;
+    memcpy(placed->data, blankQR->data, sizeof(uint8_t) * placed->width * placed->width);
+    placeInterleavedCodewords(placed, dataBlocks, ws->ecCodewords, numBlocks * numECCodewords, ecLevel);
+
+    ws->plan = *plan;
+    ws->hasSymbol = true;
+}
+
+QR* createQRCodeInto(QRWorkspace* ws, const uint8_t* data, const EncodingPlan* plan) {
+    placeQRCode(ws, data, plan);
+    return finishQRCode(ws);
+}
+
+const QRBitboard* createQRBitboardInto(QRWorkspace* ws, const uint8_t* data, const EncodingPlan* plan) {
+    placeQRCode(ws, data, plan);
+    // Only placed and the codewords are kept, ws->qr isn't written
+    ws->hasSymbol = false;
+
+    // The packed placement scores the same as placed, the reserved plane
+    // stands in for the reserved format and version modules
+    QRBitboard* bb = &ws->bitboard;
+    initQRBitboard(bb, plan->version, ws->bitboardModules);
+    packQRBitboardInto(bb, &ws->placed);
+    unsigned int bestMaskID = findBestMaskBitboard(ws, bb);
+    applyMaskBitboard(bb, getQRTemplate(plan->version)->maskPlanes, bestMaskID);
+
+    addFormatInformationBitboard(bb, plan->ecLevel, bestMaskID);
+    addVersionInformationBitboard(bb);
+
+    return bb;
+}
+
+static void getChangedCodewords(const EncodingPlan* plan, size_t changedStart, size_t changedEnd,
+        unsigned int* firstCodeword, unsigned int* endCodeword) {
+    // Numeric and alphanumeric characters are packed in groups, so widen the
+    // range to whole groups. The bits of a prefix of whole groups are the
+    // same as the payload bits of that many characters.
+    unsigned int groupSize = plan->mode == MODE_NUMERIC ? 3 : plan->mode == MODE_ALPHANUMERIC ? 2 : 1;
+    size_t groupStart = changedStart - changedStart % groupSize;
+    size_t groupEnd = MIN(plan->length, (changedEnd + groupSize - 1) / groupSize * groupSize);
+
+    unsigned int headerBits = 4 + getCharacterCountBits(plan->mode, plan->version);
+    unsigned int startBit = headerBits + getPayloadBits(plan->mode, groupStart);
+    unsigned int endBit = headerBits + getPayloadBits(plan->mode, groupEnd);
+
+    *firstCodeword = startBit / 8;
+    *endCodeword = (endBit + 7) / 8;
+}
+
+static bool samePlan(const EncodingPlan* a, const EncodingPlan* b) {
+    return a->mode == b->mode && a->ecLevel == b->ecLevel && a->length == b->length &&
+        a->bitCount == b->bitCount && a->version == b->version && a->capacity == b->capacity;
+}
+
+static bool codewordsUnchangedOutside(const QRWorkspace* ws, unsigned int firstCodeword,
+        unsigned int endCodeword) {
+    // Only the codewords in the changed range are patched, so a change the
+    // caller left out of the range would otherwise go missing from the symbol
+    unsigned int totalDataCodewords = totalDataCodewordsLUT[ws->plan.version][ws->plan.ecLevel];
+    return memcmp(ws->dataCodewords, ws->newDataCodewords, sizeof(uint8_t) * firstCodeword) == 0 &&
+        memcmp(ws->dataCodewords + endCodeword, ws->newDataCodewords + endCodeword,
+                sizeof(uint8_t) * (totalDataCodewords - endCodeword)) == 0;
+}
+
+QR* updateQRCodeInto(QRWorkspace* ws, const uint8_t* data, const EncodingPlan* plan,
+        size_t changedStart, size_t changedEnd) {
+    // The codeword layout only stays put if everything in the plan is the same
+    if (!ws->hasSymbol || !samePlan(&ws->plan, plan))
+        return createQRCodeInto(ws, data, plan);
+
+    assert(changedStart <= changedEnd && changedEnd <= plan->length);
+    unsigned int qrVersion = plan->version;
+    ErrorCorrectionLevel ecLevel = plan->ecLevel;
+    encodeDataInto(data, plan, ws->newDataCodewords);
+
+    unsigned int firstCodeword = 0, endCodeword = 0;
+    if (changedStart < changedEnd)
+        getChangedCodewords(plan, changedStart, changedEnd, &firstCodeword, &endCodeword);
+    // A range that misses a change can't be patched, start again from scratch
+    if (!codewordsUnchangedOutside(ws, firstCodeword, endCodeword))
+        return createQRCodeInto(ws, data, plan);
+    if (firstCodeword == endCodeword)
+        return &ws->qr;
+
+    unsigned int numGroup1Blocks = dataBlocksInGroup1LUT[qrVersion][ecLevel];
+    unsigned int numBlocks = numGroup1Blocks + dataBlocksInGroup2LUT[qrVersion][ecLevel];
+    unsigned int group1BlockSize = dataCodewordsPerGroup1BlockLUT[qrVersion][ecLevel];
+    unsigned int group2BlockSize = dataCodewordsPerGroup2BlockLUT[qrVersion][ecLevel];
+    unsigned int group1Codewords = numGroup1Blocks * group1BlockSize;
+    unsigned int numECCodewords = ecCodewordsPerBlockLUT[qrVersion][ecLevel];
+    unsigned int totalDataCodewords = totalDataCodewordsLUT[qrVersion][ecLevel];
+    const RSGenerator* generator = getRSGenerator(numECCodewords);
+
+    const QRTemplate* qrTemplate = getQRTemplate(qrVersion);
+    const uint16_t* positions = qrTemplate->codewordPositions[ecLevel];
+    const uint16_t* offsets = qrTemplate->dataModuleOffsets;
+    QR* placed = &ws->placed;
+
+    bool blockChanged[MAX_DATA_BLOCKS] = {false};
+    for (unsigned int i = firstCodeword; i < endCodeword; i++) {
+        uint8_t delta = ws->dataCodewords[i] ^ ws->newDataCodewords[i];
+        if (delta == 0)
+            continue;
+
+        unsigned int block, blockStart, blockSize;
+        if (i < group1Codewords) {
+            block = i / group1BlockSize;
+            blockStart = block * group1BlockSize;
+            blockSize = group1BlockSize;
+        } else {
+            block = numGroup1Blocks + (i - group1Codewords) / group2BlockSize;
+            blockStart = group1Codewords + (block - numGroup1Blocks) * group2BlockSize;
+            blockSize = group2BlockSize;
+        }
+
+        // EC codeword k of this block sits at k * numBlocks + block
+        rsUpdateParity(generator, ws->ecCodewords + block, numBlocks, blockStart + blockSize - 1 - i, delta);
+        blockChanged[block] = true;
+
+        ws->dataCodewords[i] = ws->newDataCodewords[i];
+        placeCodeword(placed, &offsets[positions[i] * 8], ws->dataCodewords[i]);
+    }
+
+    for (unsigned int block = 0; block < numBlocks; block++) {
+        if (!blockChanged[block])
+            continue;
+
+        for (unsigned int k = 0; k < numECCodewords; k++) {
+            unsigned int idx = k * numBlocks + block;
+            placeCodeword(placed, &offsets[(totalDataCodewords + idx) * 8], ws->ecCodewords[idx]);
+        }
+    }
+
+    return finishQRCode(ws);
+}
+
+QR* createQRCode(const uint8_t* data, const EncodingPlan* plan) {
+    QRWorkspace* ws = createQRWorkspace();
+    QR* qr = copyQR(createQRCodeInto(ws, data, plan));
+    freeQRWorkspace(ws);
+
+    return qr;
+}
+
+static DataBlocks* rsEncodeDataBlocksReference(DataBlocks* dataBlocks, unsigned int qrVersion,
+        ErrorCorrectionLevel ecLevel) {
+    // Same layout as rsEncodeDataBlocks(), but every block is divided by a
+    // freshly built generator polynomial
+    unsigned int numECCodewords = ecCodewordsPerBlockLUT[qrVersion][ecLevel];
+    unsigned int numBlocks = dataBlocks->numGroup1Blocks + dataBlocks->numGroup2Blocks;
+    DataBlocks* rsDataBlocks = (DataBlocks*)malloc(sizeof(DataBlocks));
+    uint8_t* codewords = (uint8_t*)malloc(sizeof(uint8_t) * numBlocks * numECCodewords);
+    PolynomialView* views = (PolynomialView*)malloc(sizeof(PolynomialView) * numBlocks);
+    PolynomialView* group2Views = NULL;
+    if (dataBlocks->numGroup2Blocks > 0)
+        group2Views = (PolynomialView*)malloc(sizeof(PolynomialView) * dataBlocks->numGroup2Blocks);
+    if (rsDataBlocks == NULL || codewords == NULL || views == NULL ||
+            (dataBlocks->numGroup2Blocks > 0 && group2Views == NULL)) {
+        perror("rsEncodeDataBlocksReference() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    rsDataBlocks->numGroup1Blocks = dataBlocks->numGroup1Blocks;
+    rsDataBlocks->numGroup2Blocks = dataBlocks->numGroup2Blocks;
+    rsDataBlocks->group1 = views;
+    rsDataBlocks->group2 = group2Views;
+    rsDataBlocks->codewords = codewords;
+    splitIntoBlocks(rsDataBlocks, codewords, numECCodewords, numECCodewords);
+
+    Polynomial* generator = createGeneratorPolynomial(numECCodewords);
+    for (unsigned int i = 0; i < numBlocks; i++) {
+        const PolynomialView* block = i < dataBlocks->numGroup1Blocks ? &dataBlocks->group1[i] :
+            &dataBlocks->group2[i - dataBlocks->numGroup1Blocks];
+
+        Polynomial* msg = createPolynomial(block->size);
+        memcpy(msg->data, block->data, sizeof(uint8_t) * block->size);
+        Polynomial* ec = rsEncodePolynomial(msg, generator);
+        assert(ec->size == numECCodewords);
+        memcpy(codewords + i * numECCodewords, ec->data, sizeof(uint8_t) * numECCodewords);
+
+        freePolynomial(ec);
+        freePolynomial(msg);
+    }
+    freePolynomial(generator);
+
+    return rsDataBlocks;
+}
+
+static void placeDataBitsReference(QR* qr, BitStream* data) {
+    // Zigzag walk that finds the data modules by looking for unset modules,
+    // rather than using the template's offset table
+    int width = (int)qr->width;
+    bool upwards = true;
+
+    for (int right = width - 1; right >= 1 && data->cursor < data->size; right -= 2) {
+        if (right == 6)
+            right--;
+
+        for (int k = 0; k < width; k++) {
+            int row = upwards ? width - 1 - k : k;
+            for (int col = right; col >= right - 1; col--) {
+                if (data->cursor < data->size && qr->data[row * width + col] == UNSET_MODULE)
+                    qr->data[row * width + col] = readBit(data);
+            }
+        }
+
+        upwards = !upwards;
+    }
+    assert(data->cursor == data->size);
+}
+
+static QR* createQRCodeReferenceWithMask(const uint8_t* data, const EncodingPlan* plan, int fixedMask) {
+    // fixedMask < 0 picks the best mask. encodeData(), fragmentEncodedData() and
+    // the pattern builders are the same code the fast engine uses, see QREngine.
+    unsigned int qrVersion = plan->version;
+    ErrorCorrectionLevel ecLevel = plan->ecLevel;
+    Polynomial* encodedData = encodeData(data, plan);
+
+    DataBlocks* dataBlocks = fragmentEncodedData(encodedData, qrVersion, ecLevel);
+    DataBlocks* rsDataBlocks = rsEncodeDataBlocksReference(dataBlocks, qrVersion, ecLevel);
+    BitStream* finalMessage = structureFinalMessage(dataBlocks, rsDataBlocks, qrVersion, ecLevel);
 
     freeDataBlocks(dataBlocks);
     dataBlocks = NULL;
     freeDataBlocks(rsDataBlocks);
     rsDataBlocks = NULL;
+    freePolynomial(encodedData);
+    encodedData = NULL;
 
+    // Build the function patterns from scratch instead of using the template
     QR* qr = initQR(qrVersion);
-
     addFinderPatterns(qr);
     addSeparators(qr);
     addAlignmentPatterns(qr);
@@ -1128,12 +1504,12 @@ QR* createQRCode(char* data, ErrorCorrectionLevel ecLevel) {
     addDarkModule(qr);
     reserveFormatInfo(qr);
     reserveVersionInfo(qr);
-    QR* blankQR = copyQR(qr); // Create a copy of the QR code before we add data bits - for masking
-    placeDataBits(qr, finalMessage);
-    freeLinkedList(finalMessage);
+    QR* blankQR = copyQR(qr);
+    placeDataBitsReference(qr, finalMessage);
+    freeBitStream(finalMessage);
     finalMessage = NULL;
 
-    unsigned int bestMaskID = calculateBestMask(qr, blankQR);
+    unsigned int bestMaskID = fixedMask < 0 ? calculateBestMask(qr, blankQR) : (unsigned int)fixedMask;
     QR* maskQR = createMask(blankQR, bestMaskID);
     QR* finalQR = applyMask(qr, maskQR);
     freeQR(blankQR);
@@ -1149,6 +1525,138 @@ QR* createQRCode(char* data, ErrorCorrectionLevel ecLevel) {
     return finalQR;
 }
 
+QR* createQRCodeReference(const uint8_t* data, const EncodingPlan* plan) {
+    return createQRCodeReferenceWithMask(data, plan, -1);
+}
+
+void initQROptions(QROptions* options) {
+    options->engine = QR_ENGINE_FAST;
+    options->crossCheck = false;
+    options->maskPolicy = QR_MASK_AUTO;
+    options->fixedMask = 0;
+    options->maskThreads = 1;
+    options->parallelMaskMinVersion = DEFAULT_PARALLEL_MASK_MIN_VERSION;
+}
+
+const char* getQREngineName(QREngine engine) {
+    switch (engine) {
+        case QR_ENGINE_FAST:
+            return "fast";
+        case QR_ENGINE_REFERENCE:
+            return "reference";
+    }
+
+    return "unknown";
+}
+
+bool parseQRMaskPolicy(const char* text, QROptions* options) {
+    if (strcmp(text, "auto") == 0) {
+        options->maskPolicy = QR_MASK_AUTO;
+    } else if (strcmp(text, "fast") == 0) {
+        options->maskPolicy = QR_MASK_FAST;
+    } else if (text[0] >= '0' && text[0] <= '7' && text[1] == '\0') {
+        options->maskPolicy = QR_MASK_FIXED;
+        options->fixedMask = text[0] - '0';
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void formatQRMaskPolicy(char* buffer, size_t size, const QROptions* options) {
+    switch (options->maskPolicy) {
+        case QR_MASK_AUTO:
+            snprintf(buffer, size, "auto");
+            break;
+        case QR_MASK_FAST:
+            snprintf(buffer, size, "fast");
+            break;
+        case QR_MASK_FIXED:
+            snprintf(buffer, size, "%u", options->fixedMask);
+            break;
+    }
+}
+
+bool findModuleMismatch(const QR* a, const QR* b, unsigned int* row, unsigned int* col) {
+    if (a->width != b->width) {
+        *row = 0;
+        *col = 0;
+        return true;
+    }
+
+    for (unsigned int i = 0; i < a->width * a->width; i++) {
+        if (a->data[i] != b->data[i]) {
+            *row = i / a->width;
+            *col = i % a->width;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static QR* createQRCodeWithEngine(const uint8_t* data, const EncodingPlan* plan, QREngine engine,
+        const QROptions* options) {
+    if (engine == QR_ENGINE_REFERENCE)
+        return createQRCodeReferenceWithMask(data, plan,
+                options->maskPolicy == QR_MASK_FIXED ? (int)options->fixedMask : -1);
+
+    QRWorkspace* ws = createQRWorkspace();
+    ws->maskPolicy = options->maskPolicy;
+    ws->fixedMask = options->fixedMask;
+    ws->maskThreads = options->maskThreads;
+    ws->parallelMaskMinVersion = options->parallelMaskMinVersion;
+    QR* qr = copyQR(createQRCodeInto(ws, data, plan));
+    freeQRWorkspace(ws);
+
+    return qr;
+}
+
+QR* createQRCodeWithOptions(const uint8_t* data, const EncodingPlan* plan, const QROptions* options) {
+    QROptions defaults;
+    if (options == NULL) {
+        initQROptions(&defaults);
+        options = &defaults;
+    }
+    assert(options->fixedMask <= 7);
+    // The reference engine has no fast mask policy to check the fast engine's against
+    assert(options->maskPolicy != QR_MASK_FAST || (options->engine == QR_ENGINE_FAST && !options->crossCheck));
+
+    QR* qr = createQRCodeWithEngine(data, plan, options->engine, options);
+    if (!options->crossCheck)
+        return qr;
+
+    QREngine otherEngine = options->engine == QR_ENGINE_REFERENCE ? QR_ENGINE_FAST : QR_ENGINE_REFERENCE;
+    QR* other = createQRCodeWithEngine(data, plan, otherEngine, options);
+
+    // A mismatch means one of the engines is broken, so no symbol is trusted
+    unsigned int row, col;
+    if (findModuleMismatch(qr, other, &row, &col)) {
+        fprintf(stderr, "createQRCodeWithOptions() - %s and %s engines differ at module (%u, %u) "
+                "of a version %u-%c symbol\n", getQREngineName(options->engine), getQREngineName(otherEngine),
+                row, col, plan->version, "LMQH"[plan->ecLevel]);
+        abort();
+    }
+    freeQR(other);
+
+    return qr;
+}
+
+QR* createQRCodeFromBytes(const uint8_t* data, size_t dataLength, ErrorCorrectionLevel ecLevel) {
+    EncodingPlan plan = planEncodingBytes(data, dataLength, ecLevel);
+
+    // Data that does not fit the largest QR code is truncated to its capacity
+    if (plan.capacity < plan.length)
+        plan = planEncodingBytes(data, plan.capacity, ecLevel);
+
+    return createQRCode(data, &plan);
+}
+
+QR* createQRCodeFromString(char* data, ErrorCorrectionLevel ecLevel) {
+    return createQRCodeFromBytes((const uint8_t*)data, strnlen(data, MAX_QR_CHARS), ecLevel);
+}
+
 void printQR(QR* qr, bool invertColors) {
     char fullBlock[] = "██";
     char spaces[] = "  ";
@@ -1165,7 +1673,7 @@ void printQR(QR* qr, bool invertColors) {
         for (int j = 0; j < width; j++) {
             if (j == 0)
                 printf("%s%s%s%s", lightModule, lightModule, lightModule, lightModule);
-            unsigned int num = qr->data[i][j];
+            unsigned int num = getModule(qr, i, j);
             if (num == 0) {
                 printf("%s", lightModule);
             } else if (num == 1) {
@@ -1,86 +1,13 @@
 #include "reedsolomon.h"
 
-static const unsigned int gf256logLUT[256] = {
-    0, 0, 1, 25, 2, 50, 26, 198,
-    3, 223, 51, 238, 27, 104, 199, 75,
-    4, 100, 224, 14, 52, 141, 239, 129,
-    28, 193, 105, 248, 200, 8, 76, 113,
-    5, 138, 101, 47, 225, 36, 15, 33,
-    53, 147, 142, 218, 240, 18, 130, 69,
-    29, 181, 194, 125, 106, 39, 249, 185,
-    201, 154, 9, 120, 77, 228, 114, 166,
-    6, 191, 139, 98, 102, 221, 48, 253,
-    226, 152, 37, 179, 16, 145, 34, 136,
-    54, 208, 148, 206, 143, 150, 219, 189,
-    241, 210, 19, 92, 131, 56, 70, 64,
-    30, 66, 182, 163, 195, 72, 126, 110,
-    107, 58, 40, 84, 250, 133, 186, 61,
-    202, 94, 155, 159, 10, 21, 121, 43,
-    78, 212, 229, 172, 115, 243, 167, 87,
-    7, 112, 192, 247, 140, 128, 99, 13,
-    103, 74, 222, 237, 49, 197, 254, 24,
-    227, 165, 153, 119, 38, 184, 180, 124,
-    17, 68, 146, 217, 35, 32, 137, 46,
-    55, 63, 209, 91, 149, 188, 207, 205,
-    144, 135, 151, 178, 220, 252, 190, 97,
-    242, 86, 211, 171, 20, 42, 93, 158,
-    132, 60, 57, 83, 71, 109, 65, 162,
-    31, 45, 67, 216, 183, 123, 164, 118,
-    196, 23, 73, 236, 127, 12, 111, 246,
-    108, 161, 59, 82, 41, 157, 85, 170,
-    251, 96, 134, 177, 187, 204, 62, 90,
-    203, 89, 95, 176, 156, 169, 160, 81,
-    11, 245, 22, 235, 122, 117, 44, 215,
-    79, 174, 213, 233, 230, 231, 173, 232,
-    116, 214, 244, 234, 168, 80, 88, 175
-};
-
-static const unsigned int gf256antilogLUT[256] = {
-    1, 2, 4, 8, 16, 32, 64, 128,
-    29, 58, 116, 232, 205, 135, 19, 38,
-    76, 152, 45, 90, 180, 117, 234, 201,
-    143, 3, 6, 12, 24, 48, 96, 192,
-    157, 39, 78, 156, 37, 74, 148, 53,
-    106, 212, 181, 119, 238, 193, 159, 35,
-    70, 140, 5, 10, 20, 40, 80, 160,
-    93, 186, 105, 210, 185, 111, 222, 161,
-    95, 190, 97, 194, 153, 47, 94, 188,
-    101, 202, 137, 15, 30, 60, 120, 240,
-    253, 231, 211, 187, 107, 214, 177, 127,
-    254, 225, 223, 163, 91, 182, 113, 226,
-    217, 175, 67, 134, 17, 34, 68, 136,
-    13, 26, 52, 104, 208, 189, 103, 206,
-    129, 31, 62, 124, 248, 237, 199, 147,
-    59, 118, 236, 197, 151, 51, 102, 204,
-    133, 23, 46, 92, 184, 109, 218, 169,
-    79, 158, 33, 66, 132, 21, 42, 84,
-    168, 77, 154, 41, 82, 164, 85, 170,
-    73, 146, 57, 114, 228, 213, 183, 115,
-    230, 209, 191, 99, 198, 145, 63, 126,
-    252, 229, 215, 179, 123, 246, 241, 255,
-    227, 219, 171, 75, 150, 49, 98, 196,
-    149, 55, 110, 220, 165, 87, 174, 65,
-    130, 25, 50, 100, 200, 141, 7, 14,
-    28, 56, 112, 224, 221, 167, 83, 166,
-    81, 162, 89, 178, 121, 242, 249, 239,
-    195, 155, 43, 86, 172, 69, 138, 9,
-    18, 36, 72, 144, 61, 122, 244, 245,
-    247, 243, 251, 235, 203, 139, 11, 22,
-    44, 88, 176, 125, 250, 233, 207, 131,
-    27, 54, 108, 216, 173, 71, 142, 1
-};
-
-unsigned int gf256Multiply(unsigned int a, unsigned int b) {
-    unsigned int logA = gf256logLUT[a];
-    unsigned int logB = gf256logLUT[b];
-
-    unsigned int sum = logA + logB;
-
-    if (sum >= 256)
-        sum %= 255;
-
-    return gf256antilogLUT[sum];
-}
+// Generators for every EC codeword count, indexed by numECCodewords
+static RSGenerator rsGenerators[RS_MAX_EC_CODEWORDS + 1];
+static pthread_once_t rsGeneratorsOnce = PTHREAD_ONCE_INIT;
+
+// syndromePowers[d][i] is a^(i*d), what a codeword of degree d contributes to
+// syndrome i per unit of its value
+static uint8_t syndromePowers[255][GF256_REGISTER_SIZE];
+static pthread_once_t syndromePowersOnce = PTHREAD_ONCE_INIT;
 
 void freePolyDivisionResult(PolyDivisionResult* result) {
     if (result->quotient != NULL) {
@@ -96,11 +23,13 @@ void freePolyDivisionResult(PolyDivisionResult* result) {
     free(result);
 }
 
-Polynomial* gf256PolyScalarMultiply(Polynomial* p, unsigned int s) {
+// The polynomial helpers are what the reference engine divides with, so they
+// stay on the scalar gf256Multiply() rather than the dispatched kernels
+Polynomial* gf256PolyScalarMultiply(Polynomial* p, uint8_t s) {
     assert(p->data != NULL && p->size > 0);
     Polynomial* newPolynomial = createPolynomial(p->size);
     for (int i = 0; i < p->size; i++)
-        newPolynomial->data[i] = p->data[i] * s;
+        newPolynomial->data[i] = gf256Multiply(p->data[i], s);
 
     return newPolynomial;
 }
@@ -135,11 +64,10 @@ PolyDivisionResult* gf256PolyDivide(Polynomial* dividend, Polynomial* divisor) {
     Polynomial* p = createPolynomial(dividend->size);
 
     // Copy the dividend into p
-    for (int i = 0; i < p->size; i++)
-        p->data[i] = dividend->data[i];
+    memcpy(p->data, dividend->data, sizeof(uint8_t) * p->size);
 
     for (int i = 0; i < dividend->size - (divisor->size - 1); i++) {
-        unsigned int coefficient = p->data[i];
+        uint8_t coefficient = p->data[i];
 
         if (coefficient == 0)
             continue;
@@ -173,7 +101,7 @@ PolyDivisionResult* gf256PolyDivide(Polynomial* dividend, Polynomial* divisor) {
 }
 
 Polynomial* createGeneratorPolynomial(unsigned int numECCodewords) {
-    assert(numECCodewords >= 7 && numECCodewords <= 30);
+    assert(numECCodewords >= RS_MIN_EC_CODEWORDS && numECCodewords <= RS_MAX_EC_CODEWORDS);
     Polynomial* p = createPolynomial(1);
     p->data[0] = 1;
 
@@ -194,6 +122,56 @@ Polynomial* createGeneratorPolynomial(unsigned int numECCodewords) {
     return p;
 }
 
+void computeGeneratorPolynomial(uint8_t* coefficients, unsigned int numECCodewords) {
+    // Same product as createGeneratorPolynomial(), multiplied out in place:
+    // each round multiplies the running product by (x + a^i)
+    assert(numECCodewords >= RS_MIN_EC_CODEWORDS && numECCodewords <= RS_MAX_EC_CODEWORDS);
+    coefficients[0] = 1;
+
+    for (int i = 0; i < numECCodewords; i++) {
+        uint8_t root = gf256antilogLUT[i];
+        coefficients[i+1] = gf256Multiply(coefficients[i], root);
+        for (int j = i; j > 0; j--)
+            coefficients[j] ^= gf256Multiply(coefficients[j-1], root);
+    }
+}
+
+static void buildRSGenerators(void) {
+    for (unsigned int n = RS_MIN_EC_CODEWORDS; n <= RS_MAX_EC_CODEWORDS; n++) {
+        RSGenerator* generator = &rsGenerators[n];
+        computeGeneratorPolynomial(generator->coefficients, n);
+        for (unsigned int i = 0; i <= n; i++) {
+            assert(generator->coefficients[i] != 0);
+            generator->logs[i] = gf256logLUT[generator->coefficients[i]];
+        }
+
+        // Built with scalar multiplies, so the tables are the same whichever
+        // kernel is active the first time a generator is needed
+        for (unsigned int f = 0; f < 256; f++) {
+            for (unsigned int k = 0; k < n; k++)
+                generator->feedbackRows[f][k] = gf256Multiply(f, generator->coefficients[k+1]);
+        }
+
+        // Each extra codeword after the 1 is one more step with a zero input
+        memcpy(generator->unitParity[0], generator->feedbackRows[1], GF256_REGISTER_SIZE);
+        for (unsigned int d = 1; d < RS_MAX_CODEWORDS; d++) {
+            const uint8_t* previous = generator->unitParity[d-1];
+            const uint8_t* row = generator->feedbackRows[previous[0]];
+            for (unsigned int k = 0; k < n; k++)
+                generator->unitParity[d][k] = previous[k+1] ^ row[k];
+        }
+
+        generator->polynomial.data = generator->coefficients;
+        generator->polynomial.size = n + 1;
+    }
+}
+
+const RSGenerator* getRSGenerator(unsigned int numECCodewords) {
+    assert(numECCodewords >= RS_MIN_EC_CODEWORDS && numECCodewords <= RS_MAX_EC_CODEWORDS);
+    pthread_once(&rsGeneratorsOnce, buildRSGenerators);
+    return &rsGenerators[numECCodewords];
+}
+
 Polynomial* rsEncodePolynomial(Polynomial* msg, Polynomial* generator) {
     size_t paddedMsgSize = msg->size + generator->size - 1;
     Polynomial* paddedMsg = createPolynomial(paddedMsgSize);
@@ -230,3 +208,213 @@ Polynomial* rsEncodePolynomial(Polynomial* msg, Polynomial* generator) {
 
     return rsEncodingResult;
 }
+
+void rsEncodeBlock(PolynomialView msg, const RSGenerator* generator, uint8_t* ecCodewords) {
+    // Systematic encoder: the remainder lives in a shift register and every
+    // message byte folds in one precomputed feedback row, which gives the same
+    // result as the long division in rsEncodePolynomial() without any GF(256)
+    // multiplies. Cells past numECCodewords stay zero because the rows are zero
+    // padded, so the register width doesn't depend on the generator.
+    size_t numECCodewords = generator->polynomial.size - 1;
+    assert(numECCodewords <= GF256_REGISTER_SIZE);
+
+    uint8_t shiftRegister[GF256_REGISTER_SIZE] = {0};
+    gf256PolyRemainder(shiftRegister, msg.data, msg.size, generator->feedbackRows);
+
+    memcpy(ecCodewords, shiftRegister, sizeof(uint8_t) * numECCodewords);
+}
+
+void rsEncodeInterleaved(const PolynomialView* blocks, size_t numBlocks, const RSGenerator* generator,
+        uint8_t* ecCodewords) {
+    // Encodes every block with the shift register of rsEncodeBlock(), running
+    // runs of equal length blocks in lockstep, and writes each EC codeword
+    // straight to its interleaved slot: codeword k of block 0, of block 1, ...
+    size_t numECCodewords = generator->polynomial.size - 1;
+    assert(numECCodewords <= GF256_REGISTER_SIZE);
+
+    uint8_t remainders[RS_MAX_LANES][GF256_REGISTER_SIZE];
+    const uint8_t* msgs[RS_MAX_LANES];
+
+    size_t first = 0;
+    while (first < numBlocks) {
+        size_t blockSize = blocks[first].size;
+        size_t numLanes = 0;
+        while (first + numLanes < numBlocks && numLanes < RS_MAX_LANES &&
+                blocks[first + numLanes].size == blockSize) {
+            msgs[numLanes] = blocks[first + numLanes].data;
+            numLanes++;
+        }
+
+        memset(remainders, 0, sizeof(remainders[0]) * numLanes);
+        gf256PolyRemainders(remainders, msgs, numLanes, blockSize, generator->feedbackRows);
+
+        for (size_t b = 0; b < numLanes; b++) {
+            for (size_t k = 0; k < numECCodewords; k++)
+                ecCodewords[k * numBlocks + first + b] = remainders[b][k];
+        }
+        first += numLanes;
+    }
+}
+
+void rsUpdateParity(const RSGenerator* generator, uint8_t* ecCodewords, size_t stride,
+        size_t distanceFromEnd, uint8_t delta) {
+    // Patches the EC codewords of a block after the message codeword
+    // distanceFromEnd codewords from its end was XORed with delta. The EC
+    // codewords are stride bytes apart, so interleaved output can be updated.
+    size_t numECCodewords = generator->polynomial.size - 1;
+    assert(distanceFromEnd + numECCodewords < RS_MAX_CODEWORDS);
+
+    if (delta == 0)
+        return;
+
+    uint8_t change[GF256_REGISTER_SIZE];
+    gf256MulScalar(change, generator->unitParity[distanceFromEnd], getGF256Multiplier(delta), numECCodewords);
+    for (size_t k = 0; k < numECCodewords; k++)
+        ecCodewords[k * stride] ^= change[k];
+}
+
+static void buildSyndromePowers(void) {
+    for (unsigned int d = 0; d < 255; d++) {
+        for (unsigned int i = 0; i < GF256_REGISTER_SIZE; i++)
+            syndromePowers[d][i] = gf256antilogLUT[(i * d) % 255];
+    }
+}
+
+bool rsCalculateSyndromes(const uint8_t* codewords, size_t size, unsigned int numECCodewords,
+        uint8_t* syndromes) {
+    // Syndrome i is the received polynomial evaluated at a^i, the roots of the
+    // generator. Rather than Horner's rule per syndrome, every codeword adds
+    // its value times a precomputed row of powers to all syndromes at once.
+    // Returns true if any syndrome is nonzero, i.e. the block has errors.
+    assert(size <= RS_MAX_CODEWORDS && numECCodewords <= GF256_REGISTER_SIZE);
+    pthread_once(&syndromePowersOnce, buildSyndromePowers);
+
+    // Codewords are walked from the end so that codeword j lines up with
+    // row j, the powers for degree j
+    uint8_t reversed[RS_MAX_CODEWORDS];
+    for (size_t p = 0; p < size; p++)
+        reversed[p] = codewords[size - 1 - p];
+
+    uint8_t accumulator[GF256_REGISTER_SIZE] = {0};
+    gf256MulAddRows(accumulator, reversed, size, syndromePowers);
+
+    uint8_t nonzero = 0;
+    for (unsigned int i = 0; i < numECCodewords; i++) {
+        syndromes[i] = accumulator[i];
+        nonzero |= accumulator[i];
+    }
+
+    return nonzero != 0;
+}
+
+bool rsCheckBlock(const uint8_t* codewords, size_t size, unsigned int numECCodewords) {
+    uint8_t syndromes[GF256_REGISTER_SIZE];
+    return !rsCalculateSyndromes(codewords, size, numECCodewords, syndromes);
+}
+
+// The decoder's polynomials are stored lowest degree first, unlike Polynomial
+static uint8_t evaluateAscending(const uint8_t* p, size_t size, uint8_t x) {
+    uint8_t result = 0;
+    for (size_t i = size; i > 0; i--)
+        result = gf256Multiply(result, x) ^ p[i-1];
+
+    return result;
+}
+
+int rsDecodeBlock(uint8_t* codewords, size_t size, unsigned int numECCodewords,
+        const unsigned int* erasures, size_t numErasures) {
+    // Corrects up to e erasures (known bad positions) and v errors in place as
+    // long as 2v + e <= numECCodewords. Returns the number of corrected
+    // codewords, or RS_DECODE_FAILURE if the block is beyond repair.
+    assert(size <= RS_MAX_CODEWORDS && numECCodewords <= GF256_REGISTER_SIZE);
+    size_t n = numECCodewords;
+    if (numErasures > n)
+        return RS_DECODE_FAILURE;
+
+    uint8_t syndromes[GF256_REGISTER_SIZE];
+    if (!rsCalculateSyndromes(codewords, size, numECCodewords, syndromes))
+        return 0;
+
+    // The codeword at position p has degree size - 1 - p, so its locator is
+    // X = a^(size - 1 - p). Erasures seed the locator with prod(1 + X x).
+    uint8_t locator[GF256_REGISTER_SIZE + 1] = {1};
+    for (size_t k = 0; k < numErasures; k++) {
+        assert(erasures[k] < size);
+        uint8_t x = gf256antilogLUT[size - 1 - erasures[k]];
+        for (size_t i = k + 1; i > 0; i--)
+            locator[i] ^= gf256Multiply(locator[i-1], x);
+    }
+
+    // Berlekamp-Massey, picking up after the erasures
+    uint8_t previous[GF256_REGISTER_SIZE + 1];
+    uint8_t next[GF256_REGISTER_SIZE + 1] = {0};
+    memcpy(previous, locator, sizeof(previous));
+    size_t length = numErasures;
+
+    for (size_t r = numErasures; r < n; r++) {
+        uint8_t discrepancy = 0;
+        for (size_t i = 0; i <= length; i++)
+            discrepancy ^= gf256Multiply(locator[i], syndromes[r - i]);
+
+        // previous becomes x * previous in every case, shift it up a degree
+        memmove(previous + 1, previous, sizeof(uint8_t) * n);
+        previous[0] = 0;
+
+        if (discrepancy == 0)
+            continue;
+
+        for (size_t i = 0; i <= n; i++)
+            next[i] = locator[i] ^ gf256Multiply(discrepancy, previous[i]);
+
+        if (2 * length <= r + numErasures) {
+            uint8_t inverse = gf256Inverse(discrepancy);
+            for (size_t i = 0; i <= n; i++)
+                previous[i] = gf256Multiply(locator[i], inverse);
+            length = r + 1 + numErasures - length;
+        }
+        memcpy(locator, next, sizeof(locator));
+    }
+
+    if (2 * (length - numErasures) + numErasures > n)
+        return RS_DECODE_FAILURE;
+
+    // Omega = S * locator mod x^n
+    uint8_t evaluator[GF256_REGISTER_SIZE] = {0};
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j <= MIN(i, length); j++)
+            evaluator[i] ^= gf256Multiply(syndromes[i - j], locator[j]);
+    }
+
+    // Formal derivative, only the odd terms survive in characteristic 2
+    uint8_t derivative[GF256_REGISTER_SIZE] = {0};
+    for (size_t i = 1; i <= length; i += 2)
+        derivative[i-1] = locator[i];
+
+    // Chien search over the positions that exist in this block, with Forney's
+    // formula for the value: Y = X * Omega(X^-1) / locator'(X^-1)
+    size_t numRoots = 0;
+    uint8_t corrected[RS_MAX_CODEWORDS];
+    memcpy(corrected, codewords, sizeof(uint8_t) * size);
+    for (size_t p = 0; p < size; p++) {
+        unsigned int degree = size - 1 - p;
+        uint8_t inverseX = gf256antilogLUT[(255 - degree) % 255];
+        if (evaluateAscending(locator, length + 1, inverseX) != 0)
+            continue;
+
+        numRoots++;
+        uint8_t denominator = evaluateAscending(derivative, length, inverseX);
+        if (denominator == 0)
+            return RS_DECODE_FAILURE;
+
+        uint8_t magnitude = gf256Multiply(gf256antilogLUT[degree],
+                gf256Multiply(evaluateAscending(evaluator, n, inverseX), gf256Inverse(denominator)));
+        corrected[p] ^= magnitude;
+    }
+
+    // Too few roots means the errors don't fit the locator's degree
+    if (numRoots != length || !rsCheckBlock(corrected, size, numECCodewords))
+        return RS_DECODE_FAILURE;
+
+    memcpy(codewords, corrected, sizeof(uint8_t) * size);
+    return (int)numRoots;
+}
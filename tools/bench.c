@@ -0,0 +1,495 @@
+// End-to-end throughput benchmark. Encodes every payload in a corpus file with
+// createQRCodeWithOptions() and reports symbols per second, payload MB/s and
+// the p50/p99 latency of a single symbol, as a text table and optionally as
+// JSON. Also reports how many matrix passes the mask search needed for each
+// symbol. Several mask policies can be benchmarked in one run, each one is
+// compared against auto by the penalty score of its symbols and how often it
+// picks the same mask.
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "qrbitboard.h"
+#include "qrencode.h"
+
+#define MAX_LINE_LENGTH 256
+#define DEFAULT_MIN_SAMPLES 200
+#define DEFAULT_MIN_SECONDS 0.1
+#define MAX_SAMPLES 100000
+// auto, fast and the eight fixed masks
+#define MAX_POLICIES 10
+
+static const char alphanumericChars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+static const char* modeNames[] = {"numeric", "alphanumeric", "byte"};
+static const char ecNames[] = "LMQH";
+
+typedef struct CorpusEntry {
+    EncodingMode mode;
+    ErrorCorrectionLevel ecLevel;
+    unsigned int version;
+    size_t length;
+    uint8_t* payload;
+    EncodingPlan plan;
+} CorpusEntry;
+
+typedef struct Corpus {
+    CorpusEntry* entries;
+    size_t numEntries;
+} Corpus;
+
+typedef struct BenchResult {
+    size_t samples;
+    double seconds;         // total time spent encoding
+    double symbolsPerSec;
+    double mbPerSec;        // payload bytes, 10^6 per MB
+    double p50us;
+    double p99us;
+    double maskPasses;      // matrix passes of the mask search, see QRMaskSearchStats
+    unsigned int penalty;   // penalty score of the symbol
+    bool sameMaskAsAuto;    // whether the symbol is the one the auto policy gives
+} BenchResult;
+
+static double monotonicSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t nextRandom(uint32_t* state) {
+    // xorshift32, the payloads only need to be reproducible, not random
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static unsigned int getModeCapacity(EncodingMode mode, unsigned int version, ErrorCorrectionLevel ecLevel) {
+    switch (mode) {
+        case MODE_NUMERIC:
+            return numericCharCapacityLUT[version][ecLevel];
+        case MODE_ALPHANUMERIC:
+            return alphanumericCharCapacityLUT[version][ecLevel];
+        default:
+            return byteCharCapacityLUT[version][ecLevel];
+    }
+}
+
+static void generatePayload(CorpusEntry* entry, uint32_t seed) {
+    entry->payload = (uint8_t*)malloc(sizeof(uint8_t) * entry->length);
+    if (entry->payload == NULL) {
+        perror("generatePayload() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t state = seed;
+    for (size_t i = 0; i < entry->length; i++) {
+        uint32_t r = nextRandom(&state);
+        switch (entry->mode) {
+            case MODE_NUMERIC:
+                entry->payload[i] = '0' + r % 10;
+                break;
+            case MODE_ALPHANUMERIC:
+                entry->payload[i] = alphanumericChars[r % 45];
+                break;
+            default:
+                entry->payload[i] = r & 0xFF;
+                break;
+        }
+    }
+
+    // Make sure the payload needs the mode it is meant to test
+    if (entry->mode == MODE_ALPHANUMERIC)
+        entry->payload[0] = 'A';
+    else if (entry->mode == MODE_BYTE)
+        entry->payload[0] = 0x00;
+}
+
+static bool parseCorpusLine(const char* line, CorpusEntry* entry, const char** error) {
+    char modeName[32];
+    char ecName;
+    unsigned int version;
+    long length = -1;
+    int fields = sscanf(line, "%31s %c %u %ld", modeName, &ecName, &version, &length);
+    if (fields < 3) {
+        *error = "expected <mode> <ec level> <version> [length]";
+        return false;
+    }
+
+    int mode = -1;
+    for (int m = 0; m < 3; m++)
+        if (strcmp(modeName, modeNames[m]) == 0)
+            mode = m;
+    if (mode == -1) {
+        *error = "unknown mode";
+        return false;
+    }
+
+    const char* ec = strchr(ecNames, toupper(ecName));
+    if (ec == NULL || *ec == '\0') {
+        *error = "unknown EC level";
+        return false;
+    }
+
+    if (version < 1 || version > 40) {
+        *error = "version out of range";
+        return false;
+    }
+
+    entry->mode = mode;
+    entry->ecLevel = ec - ecNames;
+    entry->version = version;
+    unsigned int capacity = getModeCapacity(entry->mode, version, entry->ecLevel);
+    if (fields == 4 && (length < 1 || length > capacity)) {
+        *error = "length doesn't fit the version";
+        return false;
+    }
+    entry->length = fields == 4 ? (size_t)length : capacity;
+
+    return true;
+}
+
+static Corpus loadCorpus(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    Corpus corpus = {NULL, 0};
+    size_t capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    unsigned int lineNumber = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineNumber++;
+        char* p = line;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        if (corpus.numEntries == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            corpus.entries = (CorpusEntry*)realloc(corpus.entries, sizeof(CorpusEntry) * capacity);
+            if (corpus.entries == NULL) {
+                perror("loadCorpus() - failed to realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        CorpusEntry* entry = &corpus.entries[corpus.numEntries];
+        const char* error;
+        if (!parseCorpusLine(p, entry, &error)) {
+            fprintf(stderr, "%s:%u: %s\n", path, lineNumber, error);
+            exit(EXIT_FAILURE);
+        }
+
+        // The seed only depends on the line's position, so the corpus always
+        // produces the same payloads
+        generatePayload(entry, 0x9E3779B9u ^ (uint32_t)(corpus.numEntries + 1) * 2654435761u);
+        entry->plan = planEncodingBytes(entry->payload, entry->length, entry->ecLevel);
+        if (entry->plan.mode != entry->mode || entry->plan.version != entry->version) {
+            fprintf(stderr, "%s:%u: payload was planned as %s version %u\n", path, lineNumber,
+                    modeNames[entry->plan.mode], entry->plan.version);
+            exit(EXIT_FAILURE);
+        }
+        corpus.numEntries++;
+    }
+
+    fclose(fp);
+    return corpus;
+}
+
+static void freeCorpus(Corpus* corpus) {
+    for (size_t i = 0; i < corpus->numEntries; i++)
+        free(corpus->entries[i].payload);
+    free(corpus->entries);
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t count, double p) {
+    // Nearest rank
+    size_t rank = (size_t)(p * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return sorted[MIN(rank, count) - 1];
+}
+
+static BenchResult benchEntry(const CorpusEntry* entry, const QROptions* options,
+        const QRBitboard* autoSymbol, double* latencies, size_t minSamples, double minSeconds) {
+    // Warm up the templates, generator tables, mask threads and caches first
+    for (int i = 0; i < 3; i++)
+        freeQR(createQRCodeWithOptions(entry->payload, &entry->plan, options));
+
+    BenchResult result = {0};
+
+    // The payload always gives the same symbol, so one encode is enough for
+    // the mask search figures
+    QRWorkspace* ws = createQRWorkspace();
+    ws->maskPolicy = options->maskPolicy;
+    ws->fixedMask = options->fixedMask;
+    ws->maskThreads = options->maskThreads;
+    ws->parallelMaskMinVersion = options->parallelMaskMinVersion;
+    const QRBitboard* bb = createQRBitboardInto(ws, entry->payload, &entry->plan);
+    if (ws->maskSearchStats.symbols > 0)
+        result.maskPasses = ws->maskSearchStats.matrixPasses / ws->maskSearchStats.symbols;
+    // The data is the same, so the symbols only match if the masks do
+    QRScoringPlanes* planes = (QRScoringPlanes*)malloc(sizeof(QRScoringPlanes));
+    if (planes == NULL) {
+        perror("benchEntry() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    packQRScoringPlanesBitboard(planes, bb, NULL);
+    result.penalty = scoreQRBitboard(planes);
+    result.sameMaskAsAuto = equalQRBitboards(bb, autoSymbol);
+    free(planes);
+    freeQRWorkspace(ws);
+
+    while (result.samples < MAX_SAMPLES && (result.samples < minSamples || result.seconds < minSeconds)) {
+        double start = monotonicSeconds();
+        QR* qr = createQRCodeWithOptions(entry->payload, &entry->plan, options);
+        double elapsed = monotonicSeconds() - start;
+        freeQR(qr);
+
+        latencies[result.samples++] = elapsed;
+        result.seconds += elapsed;
+    }
+
+    qsort(latencies, result.samples, sizeof(double), compareDoubles);
+    result.symbolsPerSec = result.samples / result.seconds;
+    result.mbPerSec = result.symbolsPerSec * entry->length / 1e6;
+    result.p50us = percentile(latencies, result.samples, 0.50) * 1e6;
+    result.p99us = percentile(latencies, result.samples, 0.99) * 1e6;
+
+    return result;
+}
+
+static void printHelpMessage(const char* progName) {
+    printf("Usage: %s [options] CORPUS\n", progName);
+    printf("\nOptions:\n");
+    printf("  --json=FILE         also write the results to FILE as JSON\n");
+    printf("  --min-samples=N     encode each payload at least N times (default %d)\n", DEFAULT_MIN_SAMPLES);
+    printf("  --min-seconds=S     spend at least S seconds on each payload (default %.1f)\n", DEFAULT_MIN_SECONDS);
+    printf("  --mask=MASK[,MASK]  mask policies to encode with: auto (default), fast or 0 to 7,\n");
+    printf("                      each one is benchmarked in turn\n");
+    printf("  --mask-threads=N    score the masks of version %d and up on N threads (default 1)\n",
+            DEFAULT_PARALLEL_MASK_MIN_VERSION);
+    printf("  --help              display this help message\n");
+}
+
+static size_t parseMaskPolicies(const char* text, QROptions* policies, const QROptions* defaults) {
+    // Comma separated list of policies in the form parseQRMaskPolicy() takes
+    size_t numPolicies = 0;
+    char buffer[MAX_LINE_LENGTH];
+    snprintf(buffer, sizeof(buffer), "%s", text);
+    for (char* name = strtok(buffer, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (numPolicies == MAX_POLICIES) {
+            fprintf(stderr, "At most %d mask policies can be benchmarked at once\n", MAX_POLICIES);
+            exit(EXIT_FAILURE);
+        }
+
+        policies[numPolicies] = *defaults;
+        if (!parseQRMaskPolicy(name, &policies[numPolicies])) {
+            fprintf(stderr, "Unknown mask '%s', expected 'auto', 'fast' or a mask from 0 to 7\n", name);
+            exit(EXIT_FAILURE);
+        }
+        numPolicies++;
+    }
+
+    if (numPolicies == 0) {
+        fprintf(stderr, "--mask needs at least one mask policy\n");
+        exit(EXIT_FAILURE);
+    }
+    return numPolicies;
+}
+
+int main(int argc, char** argv) {
+    const char* jsonPath = NULL;
+    const char* maskList = "auto";
+    size_t minSamples = DEFAULT_MIN_SAMPLES;
+    double minSeconds = DEFAULT_MIN_SECONDS;
+    QROptions options;
+    initQROptions(&options);
+
+    const struct option long_options[] = {
+        {"json", required_argument, NULL, 'j'},
+        {"min-samples", required_argument, NULL, 'n'},
+        {"min-seconds", required_argument, NULL, 's'},
+        {"mask", required_argument, NULL, 'm'},
+        {"mask-threads", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+                jsonPath = optarg;
+                break;
+            case 'n':
+                minSamples = strtoul(optarg, NULL, 10);
+                if (minSamples < 1 || minSamples > MAX_SAMPLES) {
+                    fprintf(stderr, "--min-samples must be between 1 and %d\n", MAX_SAMPLES);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                minSeconds = atof(optarg);
+                break;
+            case 'm':
+                maskList = optarg;
+                break;
+            case 't':
+                options.maskThreads = strtoul(optarg, NULL, 10);
+                if (options.maskThreads < 1) {
+                    fprintf(stderr, "--mask-threads must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                printHelpMessage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "Expected one corpus file\n");
+        fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    QROptions policies[MAX_POLICIES];
+    size_t numPolicies = parseMaskPolicies(maskList, policies, &options);
+    const char* corpusPath = argv[optind];
+    Corpus corpus = loadCorpus(corpusPath);
+
+    // Every policy is measured against the symbols the auto policy picks
+    QROptions autoOptions = options;
+    autoOptions.maskPolicy = QR_MASK_AUTO;
+    QRBitboard** autoSymbols = (QRBitboard**)malloc(sizeof(QRBitboard*) * corpus.numEntries);
+    double* latencies = (double*)malloc(sizeof(double) * MAX_SAMPLES);
+    if (autoSymbols == NULL || latencies == NULL) {
+        perror("main() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    // Kept packed, a v40 symbol is 4KB as a bitboard instead of 31KB
+    for (size_t i = 0; i < corpus.numEntries; i++) {
+        QR* qr = createQRCodeWithOptions(corpus.entries[i].payload, &corpus.entries[i].plan, &autoOptions);
+        autoSymbols[i] = packQRBitboard(qr);
+        freeQR(qr);
+    }
+
+    FILE* json = NULL;
+    if (jsonPath != NULL) {
+        json = fopen(jsonPath, "w");
+        if (json == NULL) {
+            fprintf(stderr, "Failed to open '%s': %s\n", jsonPath, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fprintf(json, "{\n  \"corpus\": \"%s\",\n  \"gf256_kernel\": \"%s\",\n  \"mask_threads\": %u,\n"
+                "  \"policies\": [\n", corpusPath, gf256KernelName(gf256ActiveKernel()), options.maskThreads);
+    }
+
+    char maskPolicies[MAX_POLICIES][8];
+    double policySymbolsPerSec[MAX_POLICIES];
+    double policyPenalty[MAX_POLICIES];
+    double policyAgreement[MAX_POLICIES];
+    for (size_t p = 0; p < numPolicies; p++) {
+        char* maskPolicy = maskPolicies[p];
+        formatQRMaskPolicy(maskPolicy, sizeof(maskPolicies[p]), &policies[p]);
+        printf("%smask policy: %s\n\n", p > 0 ? "\n" : "", maskPolicy);
+        if (json != NULL)
+            fprintf(json, "    {\n      \"mask\": \"%s\",\n      \"entries\": [\n", maskPolicy);
+
+        printf("%-12s %2s %7s %6s %8s %12s %10s %10s %10s %7s %7s %4s\n", "mode", "ec", "version", "bytes",
+                "samples", "symbols/s", "MB/s", "p50 us", "p99 us", "passes", "penalty", "auto");
+
+        size_t totalSymbols = 0;
+        double totalSeconds = 0;
+        double totalBytes = 0;
+        double totalMaskPasses = 0;
+        double totalPenalty = 0;
+        size_t sameMaskAsAuto = 0;
+        for (size_t i = 0; i < corpus.numEntries; i++) {
+            const CorpusEntry* entry = &corpus.entries[i];
+            BenchResult result = benchEntry(entry, &policies[p], autoSymbols[i], latencies, minSamples,
+                    minSeconds);
+            totalSymbols += result.samples;
+            totalSeconds += result.seconds;
+            totalBytes += (double)result.samples * entry->length;
+            totalMaskPasses += result.maskPasses;
+            totalPenalty += result.penalty;
+            sameMaskAsAuto += result.sameMaskAsAuto;
+
+            printf("%-12s %2c %7u %6zu %8zu %12.1f %10.3f %10.1f %10.1f %7.2f %7u %4s\n", modeNames[entry->mode],
+                    ecNames[entry->ecLevel], entry->version, entry->length, result.samples,
+                    result.symbolsPerSec, result.mbPerSec, result.p50us, result.p99us, result.maskPasses,
+                    result.penalty, result.sameMaskAsAuto ? "yes" : "no");
+            fflush(stdout);
+
+            if (json != NULL)
+                fprintf(json, "        {\"mode\": \"%s\", \"ec\": \"%c\", \"version\": %u, \"bytes\": %zu, "
+                        "\"samples\": %zu, \"symbols_per_sec\": %.1f, \"mb_per_sec\": %.4f, "
+                        "\"p50_us\": %.2f, \"p99_us\": %.2f, \"mask_passes\": %.2f, \"penalty\": %u, "
+                        "\"same_mask_as_auto\": %s}%s\n", modeNames[entry->mode], ecNames[entry->ecLevel],
+                        entry->version, entry->length, result.samples, result.symbolsPerSec, result.mbPerSec,
+                        result.p50us, result.p99us, result.maskPasses, result.penalty,
+                        result.sameMaskAsAuto ? "true" : "false", i + 1 < corpus.numEntries ? "," : "");
+        }
+
+        double symbolsPerSec = totalSymbols / totalSeconds;
+        double mbPerSec = totalBytes / totalSeconds / 1e6;
+        double maskPasses = totalMaskPasses / corpus.numEntries;
+        double meanPenalty = totalPenalty / corpus.numEntries;
+        double agreement = (double)sameMaskAsAuto / corpus.numEntries;
+        printf("\ntotal: %zu symbols in %.3f s, %.1f symbols/s, %.3f MB/s\n", totalSymbols, totalSeconds,
+                symbolsPerSec, mbPerSec);
+        printf("mask search: %.2f matrix passes per symbol on average (16 to score every mask in full)\n",
+                maskPasses);
+        printf("masks: %.1f mean penalty, same mask as auto for %zu of %zu payloads\n", meanPenalty,
+                sameMaskAsAuto, corpus.numEntries);
+
+        if (json != NULL)
+            fprintf(json, "      ],\n      \"total\": {\"symbols\": %zu, \"seconds\": %.6f, "
+                    "\"symbols_per_sec\": %.1f, \"mb_per_sec\": %.4f, \"mask_passes\": %.2f, "
+                    "\"mean_penalty\": %.2f, \"auto_agreement\": %.4f}\n    }%s\n", totalSymbols, totalSeconds,
+                    symbolsPerSec, mbPerSec, maskPasses, meanPenalty, agreement, p + 1 < numPolicies ? "," : "");
+
+        policySymbolsPerSec[p] = symbolsPerSec;
+        policyPenalty[p] = meanPenalty;
+        policyAgreement[p] = agreement;
+    }
+
+    if (numPolicies > 1) {
+        printf("\n%-6s %12s %12s %14s\n", "mask", "symbols/s", "mean penalty", "same as auto");
+        for (size_t p = 0; p < numPolicies; p++)
+            printf("%-6s %12.1f %12.1f %13.1f%%\n", maskPolicies[p], policySymbolsPerSec[p], policyPenalty[p],
+                    policyAgreement[p] * 100);
+    }
+
+    if (json != NULL) {
+        fprintf(json, "  ]\n}\n");
+        fclose(json);
+    }
+
+    for (size_t i = 0; i < corpus.numEntries; i++)
+        freeQRBitboard(autoSymbols[i]);
+    free(autoSymbols);
+    free(latencies);
+    freeCorpus(&corpus);
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Randomised differential check of the fast encoder against the reference
+// engine. Every case picks a version, EC level and mode, generates a payload
+// that lands on that version and checks that the fast engine (under every
+// GF(256) kernel the CPU supports, and through an incremental update) builds
+// exactly the same symbol as the reference engine. The engines share their data
+// encoding and function patterns, so this checks the interleaving, Reed-Solomon,
+// placement and masking stages, see QREngine. The reference symbol is always
+// built on the scalar kernel. The RS generator tables are built once and shared
+// by every kernel, so they aren't rebuilt when the kernel changes. The updated
+// symbol is also built as a QRBitboard, which has to pack, unpack and score
+// the same as the reference symbol.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qrbitboard.h"
+#include "qrencode.h"
+
+#define DEFAULT_ITERATIONS 500
+#define DEFAULT_SEED 1
+
+static const char alphanumericChars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+static const char* modeNames[] = {"numeric", "alphanumeric", "byte"};
+static const char ecNames[] = "LMQH";
+
+typedef struct CrossCheckCase {
+    unsigned int iteration;
+    EncodingMode mode;
+    ErrorCorrectionLevel ecLevel;
+    unsigned int version;
+    size_t length;
+} CrossCheckCase;
+
+static uint64_t nextRandom(uint64_t* state) {
+    // splitmix64, so a seed reproduces the exact same cases
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static unsigned int getModeCapacity(EncodingMode mode, unsigned int version, ErrorCorrectionLevel ecLevel) {
+    if (version == 0)
+        return 0;
+
+    switch (mode) {
+        case MODE_NUMERIC:
+            return numericCharCapacityLUT[version][ecLevel];
+        case MODE_ALPHANUMERIC:
+            return alphanumericCharCapacityLUT[version][ecLevel];
+        default:
+            return byteCharCapacityLUT[version][ecLevel];
+    }
+}
+
+static uint8_t randomChar(EncodingMode mode, uint64_t* state) {
+    uint64_t r = nextRandom(state);
+    switch (mode) {
+        case MODE_NUMERIC:
+            return '0' + r % 10;
+        case MODE_ALPHANUMERIC:
+            return alphanumericChars[r % 45];
+        default:
+            return r & 0xFF;
+    }
+}
+
+static void pinMode(uint8_t* payload, EncodingMode mode) {
+    // Make sure the payload needs its mode, a short random byte payload could
+    // otherwise be alphanumeric
+    if (mode == MODE_ALPHANUMERIC)
+        payload[0] = 'A';
+    else if (mode == MODE_BYTE)
+        payload[0] = 0x00;
+}
+
+static bool checkSymbol(const CrossCheckCase* c, const char* what, const QR* fast, const QR* reference) {
+    unsigned int row, col;
+    if (!findModuleMismatch(fast, reference, &row, &col))
+        return true;
+
+    fprintf(stderr, "Mismatch in case %u (%s, %s %u-%c, %zu characters): module (%u, %u) is 0x%02x, "
+            "reference has 0x%02x\n", c->iteration, what, modeNames[c->mode], c->version, ecNames[c->ecLevel],
+            c->length, row, col, fast->data[row * fast->width + col],
+            reference->data[row * reference->width + col]);
+    return false;
+}
+
+static bool checkBitboard(const CrossCheckCase* c, const QRBitboard* fast, QR* reference) {
+    QRBitboard* packed = packQRBitboard(reference);
+    QR* unpacked = unpackQRBitboard(fast);
+    QRScoringPlanes* planes = (QRScoringPlanes*)malloc(sizeof(QRScoringPlanes));
+    if (planes == NULL) {
+        perror("checkBitboard() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    packQRScoringPlanesBitboard(planes, fast, NULL);
+
+    bool ok = true;
+    if (!equalQRBitboards(fast, packed)) {
+        fprintf(stderr, "Mismatch in case %u: the bitboard differs from the packed reference\n", c->iteration);
+        ok = false;
+    } else if (!checkSymbol(c, "unpacked bitboard", unpacked, reference)) {
+        ok = false;
+    } else if (scoreQRBitboard(planes) != scoreQR(reference)) {
+        fprintf(stderr, "Mismatch in case %u: the bitboard scores %u, reference scores %u\n", c->iteration,
+                scoreQRBitboard(planes), scoreQR(reference));
+        ok = false;
+    }
+
+    free(planes);
+    freeQR(unpacked);
+    freeQRBitboard(packed);
+    return ok;
+}
+
+static void printHelpMessage(const char* progName) {
+    printf("Usage: %s [options]\n", progName);
+    printf("\nOptions:\n");
+    printf("  --iterations=N    number of random cases to check (default %d)\n", DEFAULT_ITERATIONS);
+    printf("  --seed=N          seed for the random cases (default %d)\n", DEFAULT_SEED);
+    printf("  --help            display this help message\n");
+}
+
+int main(int argc, char** argv) {
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    uint64_t seed = DEFAULT_SEED;
+
+    const struct option long_options[] = {
+        {"iterations", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'h':
+                printHelpMessage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    uint8_t* payload = (uint8_t*)malloc(sizeof(uint8_t) * MAX_QR_CHARS);
+    QRWorkspace* ws = createQRWorkspace();
+    if (payload == NULL) {
+        perror("main() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    GF256Kernel defaultKernel = gf256ActiveKernel();
+    uint64_t state = seed;
+    unsigned long symbols = 0;
+    unsigned int failures = 0;
+    for (unsigned int i = 0; i < iterations && failures == 0; i++) {
+        CrossCheckCase c;
+        c.iteration = i;
+        c.mode = nextRandom(&state) % 3;
+        c.ecLevel = nextRandom(&state) % 4;
+        c.version = 1 + nextRandom(&state) % 40;
+
+        // Any length between the previous version's capacity and this one's
+        // needs exactly this version
+        unsigned int minLength = getModeCapacity(c.mode, c.version - 1, c.ecLevel) + 1;
+        unsigned int maxLength = getModeCapacity(c.mode, c.version, c.ecLevel);
+        c.length = minLength + nextRandom(&state) % (maxLength - minLength + 1);
+        for (size_t j = 0; j < c.length; j++)
+            payload[j] = randomChar(c.mode, &state);
+        pinMode(payload, c.mode);
+
+        EncodingPlan plan = planEncodingBytes(payload, c.length, c.ecLevel);
+        if (plan.mode != c.mode || plan.version != c.version) {
+            fprintf(stderr, "Case %u: %s %u-%c payload was planned as %s version %u\n", i, modeNames[c.mode],
+                    c.version, ecNames[c.ecLevel], modeNames[plan.mode], plan.version);
+            exit(EXIT_FAILURE);
+        }
+
+        gf256UseKernel(GF256_KERNEL_SCALAR);
+        QR* reference = createQRCodeReference(payload, &plan);
+
+        for (int k = 0; k < GF256_KERNEL_COUNT; k++) {
+            if (!gf256UseKernel(k))
+                continue;
+
+            QR* fast = createQRCodeInto(ws, payload, &plan);
+            symbols++;
+            if (!checkSymbol(&c, gf256KernelName(k), fast, reference))
+                failures++;
+        }
+        gf256UseKernel(defaultKernel);
+
+        // Change a random run of the payload and update the symbol in place
+        size_t changedStart = nextRandom(&state) % c.length;
+        size_t changedEnd = changedStart + 1 + nextRandom(&state) % (c.length - changedStart);
+        for (size_t j = changedStart; j < changedEnd; j++)
+            payload[j] = randomChar(c.mode, &state);
+        pinMode(payload, c.mode);
+
+        EncodingPlan updatedPlan = planEncodingBytes(payload, c.length, c.ecLevel);
+        QR* updated = updateQRCodeInto(ws, payload, &updatedPlan, changedStart, changedEnd);
+        gf256UseKernel(GF256_KERNEL_SCALAR);
+        QR* updatedReference = createQRCodeReference(payload, &updatedPlan);
+        gf256UseKernel(defaultKernel);
+        symbols++;
+        if (!checkSymbol(&c, "incremental update", updated, updatedReference))
+            failures++;
+
+        // Last, building a bitboard leaves ws without a symbol to update
+        const QRBitboard* bb = createQRBitboardInto(ws, payload, &updatedPlan);
+        symbols++;
+        if (!checkBitboard(&c, bb, updatedReference))
+            failures++;
+
+        freeQR(updatedReference);
+        freeQR(reference);
+    }
+
+    freeQRWorkspace(ws);
+    free(payload);
+
+    if (failures > 0)
+        return EXIT_FAILURE;
+
+    printf("%lu cases, %lu fast symbols identical to the reference engine (seed %llu)\n", iterations, symbols,
+            (unsigned long long)seed);
+
+    return 0;
+}
@@ -0,0 +1,521 @@
+// Per-stage microbenchmarks for the encoder. Every stage is timed on its own
+// for each version and EC level, after a warm-up, in batches long enough for
+// the timer to be accurate. Allocations are counted by wrapping malloc() and
+// friends at link time (see the microbench target in the Makefile).
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "qrbitboard.h"
+#include "qrdecode.h"
+#include "qrencode.h"
+
+#define NUM_BATCHES 5
+#define DEFAULT_BATCH_NS 500000.0
+
+// Allocation counting, the linker sends every call here with --wrap
+static unsigned long allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    allocations++;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+    allocations++;
+    return __real_realloc(p, size);
+}
+
+// Timing, in TSC ticks where there is a TSC and nanoseconds otherwise
+static double ticksPerNs = 1.0;
+
+static inline uint64_t readTimer(void) {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static double monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void calibrateTimer(void) {
+#if defined(__x86_64__)
+    // Count ticks across ~50ms of wall clock time
+    double startNs = monotonicNs();
+    uint64_t startTicks = readTimer();
+    while (monotonicNs() - startNs < 50e6)
+        ;
+    ticksPerNs = (readTimer() - startTicks) / (monotonicNs() - startNs);
+#endif
+}
+
+// Everything a stage needs for one version and EC level, built up front so
+// that only the stage itself is timed
+typedef struct BenchContext {
+    unsigned int version;
+    ErrorCorrectionLevel ecLevel;
+    EncodingPlan plan;
+    uint8_t* payload;
+    QR* blank;
+    QR* qr;                 // blank with the data placed
+    QR* masked;             // qr with mask 0 applied, what the scorer sees
+    QR* symbol;             // the finished symbol
+    QRBitboard* symbolBitboard;     // symbol, packed
+    QR* mask;
+    QRScoringPlanes* planes;    // masked, packed for the bitboard scorer
+    QRScoringPlanes* scratchPlanes;
+    const QRMaskPlanes* maskPlanes;
+    Polynomial* generator;
+    Polynomial* firstBlock;
+    BitStream* finalMessage;
+    QRWorkspace* workspace;
+    uint8_t* decoded;
+    volatile unsigned int sink;
+} BenchContext;
+
+typedef struct Stage {
+    const char* name;
+    void (*run)(BenchContext* ctx);
+    bool perVersion;        // false for stages that don't depend on the symbol
+} Stage;
+
+static void runGF256Multiply(BenchContext* ctx) {
+    // One op is 256 multiplies, the result is scaled back in main()
+    unsigned int acc = 0;
+    for (unsigned int i = 0; i < 256; i++)
+        acc ^= gf256Multiply(i, (i * 37 + ctx->sink) & 0xFF);
+    ctx->sink = acc;
+}
+
+static void runCreateGeneratorPolynomial(BenchContext* ctx) {
+    Polynomial* generator = createGeneratorPolynomial(ecCodewordsPerBlockLUT[ctx->version][ctx->ecLevel]);
+    ctx->sink = generator->data[1];
+    freePolynomial(generator);
+}
+
+static void runRSEncodePolynomial(BenchContext* ctx) {
+    Polynomial* ec = rsEncodePolynomial(ctx->firstBlock, ctx->generator);
+    ctx->sink = ec->data[0];
+    freePolynomial(ec);
+}
+
+static void runRSEncodeBlock(BenchContext* ctx) {
+    uint8_t ec[GF256_REGISTER_SIZE];
+    const RSGenerator* generator = getRSGenerator(ecCodewordsPerBlockLUT[ctx->version][ctx->ecLevel]);
+    rsEncodeBlock(viewPolynomial(ctx->firstBlock, 0, ctx->firstBlock->size), generator, ec);
+    ctx->sink = ec[0];
+}
+
+static void runPlaceDataBits(BenchContext* ctx) {
+    ctx->finalMessage->cursor = 0;
+    placeDataBits(ctx->qr, ctx->finalMessage);
+}
+
+static void runCreateMask(BenchContext* ctx) {
+    QR* mask = createMask(ctx->blank, 0);
+    ctx->sink = mask->data[0];
+    freeQR(mask);
+}
+
+static void runApplyMask(BenchContext* ctx) {
+    QR* masked = applyMask(ctx->qr, ctx->mask);
+    ctx->sink = masked->data[0];
+    freeQR(masked);
+}
+
+static void runApplyMaskPlanes(BenchContext* ctx) {
+    // Writes the same modules applyMask() gives, so the scorers see no change
+    applyMaskPlanes(ctx->masked, ctx->qr, ctx->maskPlanes, 0);
+}
+
+static void runApplyMaskScoringPlanes(BenchContext* ctx) {
+    applyMaskScoringPlanes(ctx->scratchPlanes, ctx->planes, ctx->maskPlanes, 0);
+}
+
+static void runScoreCondition1(BenchContext* ctx) {
+    ctx->sink = scoreCondition1(ctx->masked);
+}
+
+static void runScoreCondition2(BenchContext* ctx) {
+    ctx->sink = scoreCondition2(ctx->masked);
+}
+
+static void runScoreCondition3(BenchContext* ctx) {
+    ctx->sink = scoreCondition3(ctx->masked);
+}
+
+static void runScoreCondition4(BenchContext* ctx) {
+    ctx->sink = scoreCondition4(ctx->masked);
+}
+
+static void runPackQRScoringPlanes(BenchContext* ctx) {
+    packQRScoringPlanes(ctx->planes, ctx->masked);
+}
+
+static void runScoreCondition1Bitboard(BenchContext* ctx) {
+    ctx->sink = scoreCondition1Bitboard(ctx->planes);
+}
+
+static void runScoreCondition2Bitboard(BenchContext* ctx) {
+    ctx->sink = scoreCondition2Bitboard(ctx->planes);
+}
+
+static void runScoreCondition3Bitboard(BenchContext* ctx) {
+    ctx->sink = scoreCondition3Bitboard(ctx->planes);
+}
+
+static void runScoreCondition4Bitboard(BenchContext* ctx) {
+    ctx->sink = scoreCondition4Bitboard(ctx->planes);
+}
+
+static void runScoreQRBitboard(BenchContext* ctx) {
+    ctx->sink = scoreQRBitboard(ctx->planes);
+}
+
+static void runPrintQR(BenchContext* ctx) {
+    // stdout points at /dev/null while this stage runs
+    printQR(ctx->symbol, false);
+}
+
+static void runPackQRBitboard(BenchContext* ctx) {
+    packQRBitboardInto(ctx->symbolBitboard, ctx->symbol);
+    ctx->sink = ctx->symbolBitboard->modules[0];
+}
+
+static void runPrintQRBitboard(BenchContext* ctx) {
+    // stdout points at /dev/null while this stage runs
+    printQRBitboard(ctx->symbolBitboard, false);
+}
+
+static void runCreateQRCodeInto(BenchContext* ctx) {
+    QR* qr = createQRCodeInto(ctx->workspace, ctx->payload, &ctx->plan);
+    ctx->sink = qr->data[0];
+}
+
+static void runCreateQRBitboardInto(BenchContext* ctx) {
+    const QRBitboard* bb = createQRBitboardInto(ctx->workspace, ctx->payload, &ctx->plan);
+    ctx->sink = bb->modules[0];
+}
+
+static void runDecodeQR(BenchContext* ctx) {
+    QRDecodeResult result = decodeQR(ctx->symbol, ctx->decoded, MAX_QR_CHARS);
+    ctx->sink = result.length;
+}
+
+static const Stage stages[] = {
+    {"gf256Multiply", runGF256Multiply, false},
+    {"createGeneratorPolynomial", runCreateGeneratorPolynomial, true},
+    {"rsEncodePolynomial", runRSEncodePolynomial, true},
+    {"rsEncodeBlock", runRSEncodeBlock, true},
+    {"placeDataBits", runPlaceDataBits, true},
+    {"createMask", runCreateMask, true},
+    {"applyMask", runApplyMask, true},
+    {"applyMaskPlanes", runApplyMaskPlanes, true},
+    {"scoreCondition1", runScoreCondition1, true},
+    {"scoreCondition2", runScoreCondition2, true},
+    {"scoreCondition3", runScoreCondition3, true},
+    {"scoreCondition4", runScoreCondition4, true},
+    {"packQRScoringPlanes", runPackQRScoringPlanes, true},
+    {"applyMaskScoringPlanes", runApplyMaskScoringPlanes, true},
+    {"scoreCondition1Bitboard", runScoreCondition1Bitboard, true},
+    {"scoreCondition2Bitboard", runScoreCondition2Bitboard, true},
+    {"scoreCondition3Bitboard", runScoreCondition3Bitboard, true},
+    {"scoreCondition4Bitboard", runScoreCondition4Bitboard, true},
+    {"scoreQRBitboard", runScoreQRBitboard, true},
+    {"printQR", runPrintQR, true},
+    {"packQRBitboard", runPackQRBitboard, true},
+    {"printQRBitboard", runPrintQRBitboard, true},
+    {"createQRCodeInto", runCreateQRCodeInto, true},
+    {"createQRBitboardInto", runCreateQRBitboardInto, true},
+    {"decodeQR", runDecodeQR, true},
+};
+#define NUM_STAGES (sizeof(stages) / sizeof(stages[0]))
+
+static void initBenchContext(BenchContext* ctx, unsigned int version, ErrorCorrectionLevel ecLevel) {
+    memset(ctx, 0, sizeof(BenchContext));
+    ctx->version = version;
+    ctx->ecLevel = ecLevel;
+
+    // Fill the symbol to capacity with byte mode data
+    size_t length = byteCharCapacityLUT[version][ecLevel];
+    ctx->payload = (uint8_t*)malloc(sizeof(uint8_t) * length);
+    ctx->decoded = (uint8_t*)malloc(sizeof(uint8_t) * MAX_QR_CHARS);
+    if (ctx->payload == NULL || ctx->decoded == NULL) {
+        perror("initBenchContext() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    srand(version * 4 + ecLevel);
+    for (size_t i = 0; i < length; i++)
+        ctx->payload[i] = 0x80 | rand();
+
+    ctx->plan = planEncodingBytes(ctx->payload, length, ecLevel);
+    assert(ctx->plan.version == version && ctx->plan.mode == MODE_BYTE);
+
+    Polynomial* encodedData = encodeData(ctx->payload, &ctx->plan);
+    DataBlocks* dataBlocks = fragmentEncodedData(encodedData, version, ecLevel);
+    DataBlocks* rsDataBlocks = rsEncodeDataBlocks(dataBlocks, version, ecLevel);
+    ctx->finalMessage = structureFinalMessage(dataBlocks, rsDataBlocks, version, ecLevel);
+
+    ctx->firstBlock = createPolynomial(dataBlocks->codewordsPerGroup1Block);
+    memcpy(ctx->firstBlock->data, dataBlocks->group1[0].data, sizeof(uint8_t) * ctx->firstBlock->size);
+    ctx->generator = createGeneratorPolynomial(ecCodewordsPerBlockLUT[version][ecLevel]);
+
+    freeDataBlocks(rsDataBlocks);
+    freeDataBlocks(dataBlocks);
+    freePolynomial(encodedData);
+
+    ctx->blank = copyQR(getQRTemplate(version)->blank);
+    ctx->qr = copyQR(ctx->blank);
+    placeDataBits(ctx->qr, ctx->finalMessage);
+    ctx->mask = createMask(ctx->blank, 0);
+    ctx->masked = applyMask(ctx->qr, ctx->mask);
+    ctx->maskPlanes = getQRTemplate(version)->maskPlanes;
+    ctx->planes = (QRScoringPlanes*)malloc(sizeof(QRScoringPlanes));
+    ctx->scratchPlanes = (QRScoringPlanes*)malloc(sizeof(QRScoringPlanes));
+    if (ctx->planes == NULL || ctx->scratchPlanes == NULL) {
+        perror("initBenchContext() - failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    packQRScoringPlanes(ctx->planes, ctx->masked);
+    ctx->symbol = createQRCode(ctx->payload, &ctx->plan);
+    ctx->symbolBitboard = packQRBitboard(ctx->symbol);
+    ctx->workspace = createQRWorkspace();
+}
+
+static void freeBenchContext(BenchContext* ctx) {
+    free(ctx->payload);
+    free(ctx->decoded);
+    freeQR(ctx->blank);
+    freeQR(ctx->qr);
+    freeQR(ctx->masked);
+    freeQR(ctx->symbol);
+    freeQRBitboard(ctx->symbolBitboard);
+    freeQR(ctx->mask);
+    free(ctx->planes);
+    free(ctx->scratchPlanes);
+    freePolynomial(ctx->generator);
+    freePolynomial(ctx->firstBlock);
+    freeBitStream(ctx->finalMessage);
+    freeQRWorkspace(ctx->workspace);
+}
+
+typedef struct StageResult {
+    double nsPerOp;
+    double ticksPerOp;
+    double allocationsPerOp;
+} StageResult;
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static StageResult measureStage(const Stage* stage, BenchContext* ctx, double batchNs) {
+    // Warm up caches, lazily built tables and the branch predictors, then
+    // grow the batch until it runs long enough to time
+    for (int i = 0; i < 3; i++)
+        stage->run(ctx);
+
+    unsigned long reps = 1;
+    for (;;) {
+        double start = monotonicNs();
+        for (unsigned long i = 0; i < reps; i++)
+            stage->run(ctx);
+        if (monotonicNs() - start >= batchNs || reps >= (1ul << 30))
+            break;
+        reps *= 2;
+    }
+
+    // The median batch is reported, so a stray interrupt doesn't skew it
+    double ticks[NUM_BATCHES];
+    unsigned long allocationsBefore = allocations;
+    for (int b = 0; b < NUM_BATCHES; b++) {
+        uint64_t start = readTimer();
+        for (unsigned long i = 0; i < reps; i++)
+            stage->run(ctx);
+        ticks[b] = (double)(readTimer() - start) / reps;
+    }
+    unsigned long numAllocations = allocations - allocationsBefore;
+    qsort(ticks, NUM_BATCHES, sizeof(double), compareDoubles);
+
+    StageResult result;
+    result.ticksPerOp = ticks[NUM_BATCHES / 2];
+    result.nsPerOp = result.ticksPerOp / ticksPerNs;
+    result.allocationsPerOp = (double)numAllocations / (reps * NUM_BATCHES);
+    return result;
+}
+
+static bool parseVersionList(const char* list, bool* versions) {
+    // Comma separated versions and ranges, e.g. 1,10,20-25
+    memset(versions, 0, sizeof(bool) * 41);
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+                return false;
+        }
+        if (first < 1 || last > 40 || first > last)
+            return false;
+        for (long v = first; v <= last; v++)
+            versions[v] = true;
+
+        p = end;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            return false;
+    }
+
+    return true;
+}
+
+static void printHelpMessage(const char* progName) {
+    printf("Usage: %s [options]\n", progName);
+    printf("\nOptions:\n");
+    printf("  --versions=LIST   versions to run, e.g. 1,10,20-25 (default 1-40)\n");
+    printf("  --stage=NAME      only run stages whose name contains NAME\n");
+    printf("  --batch-ms=MS     minimum length of a timed batch (default 0.5)\n");
+    printf("  --help            display this help message\n");
+}
+
+int main(int argc, char** argv) {
+    bool versions[41];
+    parseVersionList("1-40", versions);
+    const char* stageFilter = NULL;
+    double batchNs = DEFAULT_BATCH_NS;
+
+    const struct option long_options[] = {
+        {"versions", required_argument, NULL, 'V'},
+        {"stage", required_argument, NULL, 's'},
+        {"batch-ms", required_argument, NULL, 'b'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'V':
+                if (!parseVersionList(optarg, versions)) {
+                    fprintf(stderr, "Invalid version list: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                stageFilter = optarg;
+                break;
+            case 'b':
+                batchNs = atof(optarg) * 1e6;
+                break;
+            case 'h':
+                printHelpMessage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    calibrateTimer();
+
+    // The printing stages' output is thrown away, the real stdout is kept for results
+    fflush(stdout);
+    int resultsFd = dup(STDOUT_FILENO);
+    int nullFd = open("/dev/null", O_WRONLY);
+    if (resultsFd == -1 || nullFd == -1) {
+        perror("main() - failed to set up output");
+        exit(EXIT_FAILURE);
+    }
+    FILE* results = fdopen(resultsFd, "w");
+    dup2(nullFd, STDOUT_FILENO);
+
+    const char* ecNames = "LMQH";
+    fprintf(results, "# timer: %s, %.3f ticks/ns, gf256 kernel: %s\n",
+#if defined(__x86_64__)
+            "rdtsc",
+#else
+            "clock_gettime",
+#endif
+            ticksPerNs, gf256KernelName(gf256ActiveKernel()));
+    fprintf(results, "%-26s %7s %2s %14s %14s %10s\n", "stage", "version", "ec", "ns/op", "ticks/op", "allocs/op");
+
+    BenchContext ctx;
+    bool ranVersionIndependent[NUM_STAGES] = {false};
+    for (unsigned int version = 1; version <= 40; version++) {
+        if (!versions[version])
+            continue;
+
+        for (int ecLevel = EC_L; ecLevel <= EC_H; ecLevel++) {
+            initBenchContext(&ctx, version, ecLevel);
+
+            for (size_t s = 0; s < NUM_STAGES; s++) {
+                const Stage* stage = &stages[s];
+                if (stageFilter != NULL && strstr(stage->name, stageFilter) == NULL)
+                    continue;
+                if (!stage->perVersion && ranVersionIndependent[s])
+                    continue;
+                ranVersionIndependent[s] = true;
+
+                StageResult result = measureStage(stage, &ctx, batchNs);
+                fflush(stdout);
+
+                // gf256Multiply runs 256 multiplies per op
+                if (stage->run == runGF256Multiply) {
+                    result.nsPerOp /= 256;
+                    result.ticksPerOp /= 256;
+                    result.allocationsPerOp /= 256;
+                }
+
+                if (stage->perVersion)
+                    fprintf(results, "%-26s %7u %2c %14.1f %14.1f %10.2f\n", stage->name, version,
+                            ecNames[ecLevel], result.nsPerOp, result.ticksPerOp, result.allocationsPerOp);
+                else
+                    fprintf(results, "%-26s %7s %2s %14.2f %14.2f %10.2f\n", stage->name, "-", "-",
+                            result.nsPerOp, result.ticksPerOp, result.allocationsPerOp);
+                fflush(results);
+            }
+
+            freeBenchContext(&ctx);
+        }
+    }
+
+    close(nullFd);
+    fclose(results);
+
+    return 0;
+}
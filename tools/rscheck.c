@@ -0,0 +1,252 @@
+// Seeded corruption check of the Reed-Solomon decoder. Every block shape of
+// every version and EC level is encoded with random data, then corrupted with
+// errors only, erasures only and a mix of both, up to the block's capacity
+// (2 * errors + erasures <= EC codewords), under every GF(256) kernel the CPU
+// supports. rsDecodeBlock() has to restore each of those blocks exactly.
+// Blocks corrupted just past capacity are checked too: the decoder may reject
+// them or land on another codeword, but never one further from the received
+// block than it can correct.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qrencode.h"
+
+#define DEFAULT_TRIALS 8
+#define DEFAULT_SEED 1
+
+static const char ecNames[] = "LMQH";
+
+typedef enum {
+    SPLIT_ERRORS,
+    SPLIT_ERASURES,
+    SPLIT_MIXED,
+    SPLIT_BEYOND_CAPACITY,
+    SPLIT_COUNT,
+} CorruptionSplit;
+
+static const char* splitNames[] = {"errors", "erasures", "mixed", "beyond capacity"};
+
+typedef struct RSCheckCase {
+    const char* kernel;
+    unsigned int version;
+    ErrorCorrectionLevel ecLevel;
+    size_t dataSize;
+    unsigned int numECCodewords;
+    CorruptionSplit split;
+    unsigned int numErrors;
+    unsigned int numErasures;
+} RSCheckCase;
+
+typedef struct RSCheckCounts {
+    unsigned long blocks;
+    unsigned long corrected;    // within capacity, restored exactly
+    unsigned long rejected;     // beyond capacity, reported as a failure
+    unsigned long otherCodeword;    // beyond capacity, decoded to a different codeword
+    unsigned int failures;
+} RSCheckCounts;
+
+static uint64_t nextRandom(uint64_t* state) {
+    // splitmix64, so a seed reproduces the exact same cases
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static unsigned int randomBetween(uint64_t* state, unsigned int min, unsigned int max) {
+    return min + nextRandom(state) % (max - min + 1);
+}
+
+static void pickSplit(RSCheckCase* c, unsigned int trial, uint64_t* state) {
+    // Every other trial uses all of the capacity, the rest pick at random
+    unsigned int n = c->numECCodewords;
+    bool full = trial % 2 == 0;
+    switch (c->split) {
+        case SPLIT_ERRORS:
+            c->numErasures = 0;
+            c->numErrors = full ? n / 2 : randomBetween(state, 1, n / 2);
+            break;
+        case SPLIT_ERASURES:
+            c->numErasures = full ? n : randomBetween(state, 1, n);
+            c->numErrors = 0;
+            break;
+        case SPLIT_MIXED:
+            c->numErasures = randomBetween(state, 1, n - 2);
+            c->numErrors = full ? (n - c->numErasures) / 2 : randomBetween(state, 1, (n - c->numErasures) / 2);
+            break;
+        default:
+            // One or two codewords past what the EC codewords can cover
+            c->numErasures = randomBetween(state, 0, n);
+            c->numErrors = (n - c->numErasures) / 2 + 1;
+            break;
+    }
+}
+
+static void printCase(const RSCheckCase* c, const char* problem) {
+    fprintf(stderr, "%s: %s, version %u-%c block of %zu + %u codewords, %u errors and %u erasures (%s)\n",
+            problem, c->kernel, c->version, ecNames[c->ecLevel], c->dataSize, c->numECCodewords,
+            c->numErrors, c->numErasures, splitNames[c->split]);
+}
+
+static void checkBlock(RSCheckCase* c, unsigned int trial, uint64_t* state, RSCheckCounts* counts) {
+    size_t size = c->dataSize + c->numECCodewords;
+    uint8_t original[RS_MAX_CODEWORDS];
+    for (size_t i = 0; i < c->dataSize; i++)
+        original[i] = nextRandom(state) & 0xFF;
+    rsEncodeBlock((PolynomialView){original, c->dataSize}, getRSGenerator(c->numECCodewords),
+            original + c->dataSize);
+
+    pickSplit(c, trial, state);
+
+    // Shuffle the first few positions into place, the erasures come first
+    unsigned int positions[RS_MAX_CODEWORDS];
+    for (unsigned int i = 0; i < size; i++)
+        positions[i] = i;
+    unsigned int numCorrupted = c->numErasures + c->numErrors;
+    for (unsigned int i = 0; i < numCorrupted; i++) {
+        unsigned int j = randomBetween(state, i, size - 1);
+        unsigned int tmp = positions[i];
+        positions[i] = positions[j];
+        positions[j] = tmp;
+    }
+
+    // An erased codeword can hold anything, even its right value. Errors
+    // always change the codeword.
+    uint8_t received[RS_MAX_CODEWORDS];
+    memcpy(received, original, sizeof(uint8_t) * size);
+    for (unsigned int i = 0; i < numCorrupted; i++) {
+        if (i < c->numErasures)
+            received[positions[i]] = nextRandom(state) & 0xFF;
+        else
+            received[positions[i]] ^= randomBetween(state, 1, 255);
+    }
+
+    uint8_t decoded[RS_MAX_CODEWORDS];
+    memcpy(decoded, received, sizeof(uint8_t) * size);
+    int result = rsDecodeBlock(decoded, size, c->numECCodewords, positions, c->numErasures);
+    counts->blocks++;
+
+    if (c->split != SPLIT_BEYOND_CAPACITY) {
+        // Every erasure counts as corrected, unless none of the codewords
+        // changed and the decoder had nothing to do
+        bool unchanged = memcmp(received, original, sizeof(uint8_t) * size) == 0;
+        if (result != (unchanged ? 0 : (int)numCorrupted) || memcmp(decoded, original, sizeof(uint8_t) * size) != 0) {
+            printCase(c, result == RS_DECODE_FAILURE ? "Not corrected" : "Miscorrected");
+            counts->failures++;
+            return;
+        }
+        counts->corrected++;
+        return;
+    }
+
+    if (result == RS_DECODE_FAILURE) {
+        if (memcmp(decoded, received, sizeof(uint8_t) * size) != 0) {
+            printCase(c, "Changed a block it couldn't correct");
+            counts->failures++;
+        }
+        counts->rejected++;
+        return;
+    }
+
+    // Anything accepted past capacity has to be a codeword within the
+    // decoder's reach of the received block, counting the erasures as known.
+    // That rules out the original too, it is too far away.
+    unsigned int changedErrors = 0;
+    for (unsigned int i = c->numErasures; i < size; i++) {
+        if (decoded[positions[i]] != received[positions[i]])
+            changedErrors++;
+    }
+    if (!rsCheckBlock(decoded, size, c->numECCodewords) ||
+            2 * changedErrors + c->numErasures > c->numECCodewords) {
+        printCase(c, "Miscorrected past capacity");
+        counts->failures++;
+        return;
+    }
+    counts->otherCodeword++;
+}
+
+static void printHelpMessage(const char* progName) {
+    printf("Usage: %s [options]\n", progName);
+    printf("\nOptions:\n");
+    printf("  --trials=N    blocks of each shape to corrupt per split and kernel (default %d)\n", DEFAULT_TRIALS);
+    printf("  --seed=N      seed for the data and the corruption (default %d)\n", DEFAULT_SEED);
+    printf("  --help        display this help message\n");
+}
+
+int main(int argc, char** argv) {
+    unsigned long trials = DEFAULT_TRIALS;
+    uint64_t seed = DEFAULT_SEED;
+
+    const struct option long_options[] = {
+        {"trials", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                trials = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'h':
+                printHelpMessage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    GF256Kernel defaultKernel = gf256ActiveKernel();
+    uint64_t state = seed;
+    RSCheckCounts counts = {0};
+    unsigned int numKernels = 0;
+    for (int k = 0; k < GF256_KERNEL_COUNT; k++) {
+        if (!gf256UseKernel(k))
+            continue;
+        numKernels++;
+
+        RSCheckCase c;
+        c.kernel = gf256KernelName(k);
+        for (c.version = 1; c.version <= 40; c.version++) {
+            for (c.ecLevel = EC_L; c.ecLevel <= EC_H; c.ecLevel++) {
+                c.numECCodewords = ecCodewordsPerBlockLUT[c.version][c.ecLevel];
+
+                // Group 1 and, if there is one, group 2 blocks are a codeword longer
+                size_t dataSizes[2] = {dataCodewordsPerGroup1BlockLUT[c.version][c.ecLevel],
+                        dataCodewordsPerGroup2BlockLUT[c.version][c.ecLevel]};
+                unsigned int numShapes = dataBlocksInGroup2LUT[c.version][c.ecLevel] > 0 ? 2 : 1;
+                for (unsigned int shape = 0; shape < numShapes; shape++) {
+                    c.dataSize = dataSizes[shape];
+                    for (c.split = 0; c.split < SPLIT_COUNT; c.split++) {
+                        for (unsigned int trial = 0; trial < trials; trial++)
+                            checkBlock(&c, trial, &state, &counts);
+                    }
+                }
+            }
+        }
+    }
+    gf256UseKernel(defaultKernel);
+
+    if (counts.failures > 0) {
+        fprintf(stderr, "%u of %lu blocks failed (seed %llu)\n", counts.failures, counts.blocks,
+                (unsigned long long)seed);
+        return EXIT_FAILURE;
+    }
+
+    printf("%lu blocks under %u GF(256) kernels (seed %llu): %lu corrected, %lu past capacity rejected, "
+            "%lu past capacity decoded to another codeword\n", counts.blocks, numKernels,
+            (unsigned long long)seed, counts.corrected, counts.rejected, counts.otherCodeword);
+
+    return 0;
+}